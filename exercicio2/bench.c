@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+
+
+static int bench_compare(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *) a;
+    unsigned long y = *(const unsigned long *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Returns: the sample below which a fraction of the sorted samples are,
+ *  0 if there are none
+ */
+static unsigned long bench_percentile(unsigned long *ns, unsigned long count, double fraction) {
+    unsigned long index = (unsigned long) (fraction * count);
+
+    if (count == 0) {
+        return 0;
+    }
+    return ns[index < count ? index : count - 1];
+}
+
+/*
+ * Prints the counters of sorted samples as the members of a JSON object.
+ */
+static void bench_print_samples(FILE *fp, unsigned long *ns, unsigned long count, double seconds) {
+    fprintf(fp, "\"ops\": %lu, \"ops_per_sec\": %.0f, "
+            "\"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu",
+            count, seconds > 0 ? count / seconds : 0.0,
+            bench_percentile(ns, count, 0.50), bench_percentile(ns, count, 0.99),
+            bench_percentile(ns, count, 0.999), count > 0 ? ns[count - 1] : 0);
+}
+
+
+/*
+ * Returns: nanoseconds on the monotonic clock, which is not changed by
+ *  adjustments to the time of day
+ */
+unsigned long bench_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+/*
+ * Adds the latency of a command to the samples of its operation. Other
+ * operations are not counted.
+ */
+void bench_record(BenchStats *stats, char op, unsigned long ns) {
+    char *found = strchr(BENCH_OPS, op);
+
+    if (op == '\0' || found == NULL) {
+        return;
+    }
+    BenchSamples *samples = &stats->ops[found - BENCH_OPS];
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity > 0 ? 2 * samples->capacity : 4096;
+        samples->ns = realloc(samples->ns, samples->capacity * sizeof(unsigned long));
+        if (samples->ns == NULL) {
+            perror("Error: can't allocate samples.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    samples->ns[samples->count++] = ns;
+}
+
+/*
+ * Frees the samples of n consumers, leaving them empty.
+ */
+void bench_free(BenchStats *stats, int n) {
+    for (int i = 0; i < n; i++) {
+        for (int op = 0; op < BENCH_NOPS; op++) {
+            free(stats[i].ops[op].ns);
+        }
+        memset(&stats[i], 0, sizeof(BenchStats));
+    }
+}
+
+/*
+ * Prints a string as a JSON string.
+ */
+void bench_print_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(fp, "\\%c", *s);
+        }
+        else if ((unsigned char) *s < 0x20) {
+            fprintf(fp, "\\u%04x", (unsigned char) *s);
+        }
+        else {
+            fputc(*s, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/*
+ * Prints a run as a JSON object: the throughput and latency percentiles
+ * of all the commands, then of each operation.
+ * Input:
+ *  - fp: file to print to
+ *  - stats: array of the samples of each consumer
+ *  - threads: number of consumers of the run
+ *  - seconds: duration of the run
+ */
+void bench_print_run(FILE *fp, BenchStats *stats, int threads, double seconds) {
+    unsigned long total = 0;
+
+    for (int i = 0; i < threads; i++) {
+        for (int op = 0; op < BENCH_NOPS; op++) {
+            total += stats[i].ops[op].count;
+        }
+    }
+    unsigned long *all = malloc((total > 0 ? total : 1) * sizeof(unsigned long));
+    if (all == NULL) {
+        perror("Error: can't allocate samples.");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(fp, "    {\"threads\": %d, \"seconds\": %.4f, \"by_op\": {", threads, seconds);
+    unsigned long merged = 0;
+    for (int op = 0; op < BENCH_NOPS; op++) {
+        unsigned long start = merged;
+        for (int i = 0; i < threads; i++) {
+            BenchSamples *samples = &stats[i].ops[op];
+            memcpy(all + merged, samples->ns, samples->count * sizeof(unsigned long));
+            merged += samples->count;
+        }
+        qsort(all + start, merged - start, sizeof(unsigned long), bench_compare);
+        fprintf(fp, "%s\"%c\": {", op > 0 ? ", " : "", BENCH_OPS[op]);
+        bench_print_samples(fp, all + start, merged - start, seconds);
+        fputc('}', fp);
+    }
+    qsort(all, total, sizeof(unsigned long), bench_compare);
+    fprintf(fp, "}, ");
+    bench_print_samples(fp, all, total, seconds);
+    fputc('}', fp);
+    free(all);
+}
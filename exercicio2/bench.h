@@ -0,0 +1,35 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+
+/*
+ * Latency samples for the benchmark mode. Each consumer times the
+ * commands it applies with the monotonic clock and keeps the samples of
+ * each operation apart, in its own arrays, so recording takes no lock.
+ * The samples of a run are merged and sorted once it is over, and the
+ * run is printed as a JSON object.
+ */
+#define BENCH_OPS "cldm"
+#define BENCH_NOPS 4
+
+
+typedef struct benchSamples {
+    unsigned long *ns;
+    unsigned long count;
+    unsigned long capacity;
+} BenchSamples;
+
+/* samples of a consumer, only written by its own thread */
+typedef struct benchStats {
+    BenchSamples ops[BENCH_NOPS];       /* in the order of BENCH_OPS */
+} BenchStats;
+
+
+unsigned long bench_now(void);
+void bench_record(BenchStats *stats, char op, unsigned long ns);
+void bench_free(BenchStats *stats, int n);
+void bench_print_string(FILE *fp, const char *s);
+void bench_print_run(FILE *fp, BenchStats *stats, int threads, double seconds);
+
+#endif /* BENCH_H */
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "executor.h"
+#include "fs/path.h"
+#include "fs/state.h"
+
+/* commands are copied a word at a time, see exec_copy */
+typedef unsigned long __attribute__((may_alias)) ExecWord;
+_Static_assert(sizeof(Command) % sizeof(ExecWord) == 0, "Command is not a whole number of words");
+
+
+/*
+ * Copies a command in or out of a deque. A thief copies a command before
+ * claiming it and the owner may be reusing the cell by then, so the words
+ * are read and written atomically; a torn copy is thrown away when the
+ * claim fails.
+ */
+static void exec_copy(Command *to, const Command *from) {
+    ExecWord *t = (ExecWord *) to;
+    const ExecWord *f = (const ExecWord *) from;
+
+    for (size_t i = 0; i < sizeof(Command) / sizeof(ExecWord); i++) {
+        __atomic_store_n(&t[i], __atomic_load_n(&f[i], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+}
+
+static Command *deque_cell(WorkDeque *deque, long index) {
+    return &deque->commands[index & (EXEC_DEQUE_SIZE - 1)];
+}
+
+/*
+ * Adds a command at the bottom of a deque. Only called by its owner.
+ * Returns: 1 if added, 0 if the deque is full
+ */
+static int deque_push(WorkDeque *deque, const Command *command) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+    if (bottom - top >= EXEC_DEQUE_SIZE) {
+        return 0;
+    }
+    exec_copy(deque_cell(deque, bottom), command);
+    /* the command is written before thieves can see it */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/*
+ * Takes the command at the bottom of a deque. Only called by its owner,
+ * which races the thieves only for the last command.
+ * Returns: 1 if a command was taken, 0 if the deque is empty
+ */
+static int deque_take(WorkDeque *deque, Command *command) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    long top;
+    int taken = 1;
+
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    /* thieves must see the bottom moved before the top is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (top > bottom) {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    exec_copy(command, deque_cell(deque, bottom));
+    if (top == bottom) {
+        taken = __atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return taken;
+}
+
+/*
+ * Takes the command at the top of another worker's deque.
+ * Returns: 1 if a command was taken, 0 if the deque is empty or another
+ *  thread took it first
+ */
+static int deque_steal(WorkDeque *deque, Command *command) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+    if (top >= bottom) {
+        return 0;
+    }
+    exec_copy(command, deque_cell(deque, top));
+    return __atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Returns: the worker of the directory a command's node is in, by the
+ *  hash of its canonical path (see fs/path.h)
+ */
+static int exec_route(Executor *exec, Command *command) {
+    unsigned int hash = PATH_HASH_INIT;
+    unsigned int parent = PATH_HASH_INIT;
+    int depth = 0;
+    int in_component = 0;
+
+    for (char *c = command_path(command); *c != '\0'; c++) {
+        if (*c == '/') {
+            in_component = 0;
+            continue;
+        }
+        if (!in_component) {
+            parent = hash;
+            if (depth > 0) {
+                hash = PATH_HASH_STEP(hash, '/');
+            }
+            depth++;
+            in_component = 1;
+        }
+        hash = PATH_HASH_STEP(hash, *c);
+    }
+    return parent % exec->workers;
+}
+
+/*
+ * Returns: 1 if some deque or inbox has commands, 0 otherwise
+ */
+static int exec_has_work(Executor *exec) {
+    for (int i = 0; i < exec->workers; i++) {
+        WorkDeque *deque = &exec->deques[i];
+        unsigned long added, removed;
+
+        if (__atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST) >
+            __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST)) {
+            return 1;
+        }
+        queue_counts(&exec->inboxes[i], &added, &removed);
+        if (added > removed) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Moves commands from a worker's inbox to its empty deque, the oldest
+ * last, so the owner takes them in the order they were submitted and
+ * thieves take the newest.
+ * Returns: number of commands moved
+ */
+static int exec_refill(Executor *exec, int worker) {
+    Command commands[EXEC_REFILL];
+    int n = queue_try_dequeue(&exec->inboxes[worker], commands, EXEC_REFILL, NULL);
+
+    for (int i = n - 1; i >= 0; i--) {
+        deque_push(&exec->deques[worker], &commands[i]);
+    }
+    /* the others may take a share */
+    if (n > 1) {
+        queue_event_signal(&exec->idle, 1);
+    }
+    return n;
+}
+
+/*
+ * Takes up to max commands from another worker: from the top of a deque,
+ * or else from an inbox.
+ * Returns: number of commands taken
+ */
+static int exec_steal(Executor *exec, int worker, Command *commands, int max) {
+    for (int i = 1; i < exec->workers; i++) {
+        WorkDeque *victim = &exec->deques[(worker + i) % exec->workers];
+        int n = 0;
+
+        while (n < max && deque_steal(victim, &commands[n])) {
+            n++;
+        }
+        if (n > 0) {
+            return n;
+        }
+    }
+    for (int i = 1; i < exec->workers; i++) {
+        int n = queue_try_dequeue(&exec->inboxes[(worker + i) % exec->workers], commands, max, NULL);
+        if (n > 0) {
+            return n;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Initializes an executor with no commands.
+ * Input:
+ *  - exec: the executor
+ *  - workers: number of workers
+ *  - capacity: number of commands each inbox holds
+ * Returns: SUCCESS or FAIL
+ */
+int exec_init(Executor *exec, int workers, int capacity) {
+    memset(exec, 0, sizeof(Executor));
+    if (workers <= 0) {
+        return FAIL;
+    }
+    exec->workers = workers;
+    exec->deques = calloc(workers, sizeof(WorkDeque));
+    exec->inboxes = calloc(workers, sizeof(CommandQueue));
+    if (exec->deques == NULL || exec->inboxes == NULL) {
+        free(exec->deques);
+        free(exec->inboxes);
+        return FAIL;
+    }
+    for (int i = 0; i < workers; i++) {
+        if (posix_memalign((void **) &exec->deques[i].commands, 64,
+                           EXEC_DEQUE_SIZE * sizeof(Command)) != 0 ||
+            !queue_init(&exec->inboxes[i], capacity)) {
+            perror("Error: can't allocate executor.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return SUCCESS;
+}
+
+void exec_destroy(Executor *exec) {
+    for (int i = 0; i < exec->workers; i++) {
+        free(exec->deques[i].commands);
+        queue_destroy(&exec->inboxes[i]);
+    }
+    free(exec->deques);
+    free(exec->inboxes);
+}
+
+/*
+ * Submits commands, each to the inbox of its worker, waiting while that
+ * inbox is full.
+ * Input:
+ *  - exec: the executor
+ *  - commands: array of n commands
+ */
+void exec_submit(Executor *exec, Command *commands, int n) {
+    for (int i = 0; i < n; i++) {
+        CommandQueue *inbox = &exec->inboxes[exec_route(exec, &commands[i])];
+
+        if (!queue_try_enqueue(inbox, &commands[i])) {
+            /* the commands before it may be all there is to run */
+            queue_event_signal(&exec->idle, INT_MAX);
+            queue_enqueue(inbox, &commands[i]);
+        }
+    }
+    queue_event_signal(&exec->idle, n);
+}
+
+/*
+ * Takes commands for a worker to run, up to max, from its own deque if it
+ * has any, waiting while there are none anywhere and the executor is open.
+ * Input:
+ *  - exec: the executor
+ *  - worker: the worker, from 0
+ *  - commands: array of max commands to store them
+ *  - stats: counters of the worker
+ * Returns: number of commands taken, 0 if the executor is closed and empty
+ */
+int exec_take(Executor *exec, int worker, Command *commands, int max, ExecStats *stats) {
+    WorkDeque *own = &exec->deques[worker];
+
+    for (;;) {
+        int n = 0;
+
+        while (n < max && deque_take(own, &commands[n])) {
+            n++;
+        }
+        if (n > 0) {
+            stats->local += n;
+            return n;
+        }
+        if (exec_refill(exec, worker) > 0) {
+            stats->refills++;
+            continue;
+        }
+        if ((n = exec_steal(exec, worker, commands, max)) > 0) {
+            stats->stolen += n;
+            return n;
+        }
+
+        /* work submitted once this thread is counted signals it */
+        __atomic_add_fetch(&exec->idle, QUEUE_WAITER, __ATOMIC_SEQ_CST);
+        int closed = __atomic_load_n(&exec->closed, __ATOMIC_SEQ_CST);
+        int empty = !exec_has_work(exec);
+        if (empty && !closed) {
+            queue_event_wait(&exec->idle);
+            stats->sleeps++;
+        }
+        queue_event_leave(&exec->idle);
+        if (empty && closed) {
+            return 0;
+        }
+    }
+}
+
+/*
+ * Marks the end of the commands: workers return once none is left. Must
+ * be called after the last command is submitted.
+ */
+void exec_close(Executor *exec) {
+    __atomic_store_n(&exec->closed, 1, __ATOMIC_SEQ_CST);
+    /* those not counted yet see it before they sleep */
+    queue_event_signal(&exec->idle, INT_MAX);
+}
+
+/*
+ * Prints the counters of the workers, merged.
+ * Input:
+ *  - fp: file to print to
+ *  - stats: array of n counters
+ */
+void exec_print_stats(FILE *fp, ExecStats *stats, int n) {
+    ExecStats total;
+
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < n; i++) {
+        total.local += stats[i].local;
+        total.stolen += stats[i].stolen;
+        total.refills += stats[i].refills;
+        total.sleeps += stats[i].sleeps;
+    }
+    unsigned long commands = total.local + total.stolen;
+    fprintf(fp, "executor: %lu commands, %lu stolen (%.1f%%), %lu refills, %lu sleeps\n",
+            commands, total.stolen,
+            commands > 0 ? 100.0 * total.stolen / commands : 0.0,
+            total.refills, total.sleeps);
+}
@@ -0,0 +1,59 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stdio.h>
+#include "command.h"
+#include "queue.h"
+
+/*
+ * Work-stealing executor: each worker owns a deque of commands
+ * (Chase-Lev) and an inbox, a queue the commands submitted to it go to.
+ * A command is submitted to the worker of the directory its node is in,
+ * so commands on the same directory tend to run on the same thread and
+ * find its inode, locks and dcache entries in that thread's cache.
+ *
+ * A worker moves commands from its inbox to the bottom of its deque and
+ * takes them from there, in the order they were submitted, touching no
+ * shared index while it has work. An idle worker steals from the top of
+ * the others' deques, then from their inboxes. Only when nothing is left
+ * anywhere does it sleep, on a futex event (see queue.h) signalled when
+ * work is submitted and some sleeper was not signalled yet.
+ */
+#define EXEC_DEQUE_SIZE 256
+/* commands moved from the inbox to the deque at a time */
+#define EXEC_REFILL 64
+
+
+/* Chase-Lev deque: the owner pushes and takes at the bottom, thieves
+ * take at the top */
+typedef struct workDeque {
+    long top __attribute__((aligned(64)));
+    long bottom __attribute__((aligned(64)));
+    Command *commands;      /* EXEC_DEQUE_SIZE of them, as a ring */
+} WorkDeque;
+
+/* counters of a worker, only written by its own thread */
+typedef struct execStats {
+    unsigned long local;        /* commands taken from its own deque */
+    unsigned long stolen;       /* commands taken from other workers */
+    unsigned long refills;      /* batches moved from its inbox */
+    unsigned long sleeps;
+} ExecStats;
+
+typedef struct executor {
+    int workers;
+    WorkDeque *deques;
+    CommandQueue *inboxes;
+    unsigned int idle __attribute__((aligned(64)));     /* event of the sleepers */
+    int closed;
+} Executor;
+
+
+int exec_init(Executor *exec, int workers, int capacity);
+void exec_destroy(Executor *exec);
+void exec_submit(Executor *exec, Command *commands, int n);
+int exec_take(Executor *exec, int worker, Command *commands, int max, ExecStats *stats);
+void exec_close(Executor *exec);
+void exec_print_stats(FILE *fp, ExecStats *stats, int n);
+
+#endif /* EXECUTOR_H */
@@ -0,0 +1,47 @@
+#ifndef BRAVO_H
+#define BRAVO_H
+
+#include <pthread.h>
+
+/*
+ * Reader-biased read-write lock (BRAVO). While the lock is biased,
+ * readers do not touch the shared reader count of the underlying
+ * pthread_rwlock_t: each reader publishes the lock in a slot of a global
+ * table of visible readers, picked by hashing the thread and the lock, so
+ * readers on different cores write to different cache lines. A writer
+ * takes the underlying lock, revokes the bias and waits for the visible
+ * readers to leave.
+ *
+ * Bias is switched on by the readers themselves, once BRAVO_READ_RATIO
+ * reads have gone through the underlying lock without a write in between,
+ * and not before the inhibit window set by the last revocation ends. The
+ * window is BRAVO_INHIBIT times what the revocation cost, so locks that
+ * are written often stay plain read-write locks. TECNICOFS_BRAVO=0 never
+ * biases any lock.
+ */
+#define BRAVO_SLOTS 4096
+#define BRAVO_READ_RATIO 64
+#define BRAVO_INHIBIT 9
+
+/* fast read locks a thread may hold at once, more go to the lock */
+#define BRAVO_MAX_HELD 8
+
+
+typedef struct bravoLock {
+    pthread_rwlock_t lock;
+    int rbias;                      /* readers may use the visible readers table */
+    unsigned int slow_reads;        /* reads through lock since the last write */
+    unsigned long inhibit_until;    /* ns, no bias before this */
+} BravoLock;
+
+
+void bravo_configure();
+int bravo_init(BravoLock *lock);
+int bravo_destroy(BravoLock *lock);
+int bravo_rdlock(BravoLock *lock);
+int bravo_tryrdlock(BravoLock *lock);
+int bravo_wrlock(BravoLock *lock);
+int bravo_trywrlock(BravoLock *lock);
+int bravo_unlock(BravoLock *lock);
+
+#endif /* BRAVO_H */
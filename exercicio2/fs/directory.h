@@ -0,0 +1,68 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <stdint.h>
+#include "../tecnicofs-api-constants.h"
+
+/*
+ * Small directories keep their entries in a flat array that is scanned
+ * linearly. Once a directory needs more than DIR_INLINE_MAX entries it is
+ * converted into an open-addressing hash table keyed by name, and it goes
+ * back to a flat array when it shrinks to DIR_SHRINK_COUNT entries.
+ * Capacities are multiples of DIRSCAN_GROUP.
+ */
+#define DIR_INLINE_INITIAL 8
+#define DIR_INLINE_MAX 32
+#define DIR_HASH_INITIAL 128
+#define DIR_SHRINK_COUNT (DIR_INLINE_MAX / 4)
+
+/* marks a removed hash table slot, so probe chains are not broken */
+#define DIR_TOMBSTONE -2
+
+/* returned by optimistic lookups that saw the directory change */
+#define DIR_RETRY -3
+
+/* names up to this length are stored inside the slot */
+#define DIR_SHORT_NAME 22
+
+
+/*
+ * Name of an entry. Longer names are kept in the name pool, and chars
+ * holds a pointer to the pooled copy instead (see dir_slot_name).
+ */
+typedef struct dirName {
+	unsigned char len;
+	char chars[DIR_SHORT_NAME + 1];
+} DirName;
+
+/*
+ * Entries of a directory, either a flat array or a hash table. Slots are
+ * stored as parallel arrays, so scans over i-numbers or name hashes read
+ * contiguous memory: slot i holds inumbers[i] (or FREE_INODE or
+ * DIR_TOMBSTONE), the hash of its name in hashes[i], and its name in
+ * names[i]. Bit i of the occupied bitmap is set while slot i holds an
+ * entry. The arrays share one allocation.
+ */
+typedef struct directory {
+	int hashed;     /* 0: flat array, 1: hash table */
+	int count;      /* entries in use */
+	int used;       /* slots in use or holding tombstones */
+	int capacity;   /* number of slots, a power of two */
+	uint64_t *occupied;
+	int *inumbers;
+	unsigned int *hashes;
+	DirName *names;
+} Directory;
+
+
+Directory *dir_create();
+void dir_destroy(Directory *dir);
+int dir_lookup(Directory *dir, char *name, int len, unsigned int hash);
+int dir_lookup_optimistic(Directory *dir, char *name, int len, unsigned int hash,
+                          unsigned int *seq, unsigned int start);
+int dir_insert(Directory *dir, char *name, int len, unsigned int hash, int inumber);
+int dir_remove(Directory *dir, char *name, int len, unsigned int hash, int inumber);
+int dir_is_empty(Directory *dir);
+int dir_next_entry(Directory *dir, int *cursor, char *name);
+
+#endif /* DIRECTORY_H */
@@ -0,0 +1,38 @@
+#ifndef FILEDATA_H
+#define FILEDATA_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+/*
+ * Contents of a file. Files of up to FILE_INLINE_SIZE bytes are stored in
+ * the i-node itself. Larger files are split in pages of FILE_PAGE_SIZE
+ * bytes, reached through a page table, so growing a file never moves the
+ * data already written. Pages that were never written are holes and read
+ * as zeros. Bytes past the end of the file in an allocated page are kept
+ * zeroed.
+ */
+#define FILE_INLINE_SIZE 32
+#define FILE_PAGE_SHIFT 12
+#define FILE_PAGE_SIZE (1 << FILE_PAGE_SHIFT)
+#define FILE_TABLE_INITIAL 8
+
+
+typedef struct fileData {
+	size_t size;
+	int paged;      /* 0: contents inline, 1: in pages */
+	int npages;     /* slots in the page table */
+	union {
+		char bytes[FILE_INLINE_SIZE];
+		char **pages;
+	} u;
+} FileData;
+
+
+void file_init(FileData *file);
+void file_destroy(FileData *file);
+int file_write(FileData *file, char *buf, size_t len, size_t offset);
+int file_read(FileData *file, char *buf, size_t len, size_t offset);
+int file_read_iov(FileData *file, size_t offset, size_t len, struct iovec *iov, int iovcnt);
+
+#endif /* FILEDATA_H */
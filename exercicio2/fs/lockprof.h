@@ -0,0 +1,39 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "bravo.h"
+
+/*
+ * Optional lock profiler, enabled with TECNICOFS_LOCKPROF=<n>, where n is
+ * how many locks the report lists (10 if not a number). For every lock
+ * it counts acquisitions, acquisitions that had to wait, time waited
+ * (also as a histogram of powers of two, in microseconds) and time held.
+ * I-node locks are identified by their i-number, other locks by the
+ * negative ids below. Every thread counts in its own table, without
+ * locking; the tables are only merged by lockprof_report. Disabled, a
+ * lock costs one extra branch.
+ */
+#define LOCKPROF_TREE -1            /* tree lock of the server */
+#define LOCKPROF_INODE_ALLOC -2     /* i-node allocation lock */
+#define LOCKPROF_GLOBALS 2
+
+#define LOCKPROF_BUCKETS 16
+#define LOCKPROF_DEFAULT_TOP 10
+
+
+extern int lockprof_enabled;
+
+void lockprof_init();
+void lockprof_destroy();
+int lockprof_rdlock(BravoLock *lock, int id);
+int lockprof_wrlock(BravoLock *lock, int id);
+int lockprof_tryrdlock(BravoLock *lock, int id);
+int lockprof_trywrlock(BravoLock *lock, int id);
+int lockprof_rwunlock(BravoLock *lock, int id);
+int lockprof_mutex_lock(pthread_mutex_t *lock, int id);
+int lockprof_mutex_unlock(pthread_mutex_t *lock, int id);
+void lockprof_report(FILE *fp);
+
+#endif /* LOCKPROF_H */
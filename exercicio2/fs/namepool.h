@@ -0,0 +1,20 @@
+#ifndef NAMEPOOL_H
+#define NAMEPOOL_H
+
+#include <stddef.h>
+
+/*
+ * Shared pool of interned entry names. Names too long to be stored inside
+ * a directory entry live here once, with a reference count, however many
+ * directories use them.
+ */
+#define NAMEPOOL_INITIAL_BUCKETS 64
+
+
+void namepool_init();
+void namepool_destroy();
+char *namepool_intern(char *name, int len, unsigned int hash);
+void namepool_release(char *name);
+size_t namepool_bytes();
+
+#endif /* NAMEPOOL_H */
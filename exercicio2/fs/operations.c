@@ -1,10 +1,15 @@
 #include "operations.h"
+#include "dcache.h"
+#include "seqlock.h"
+#include "epoch.h"
+#include "lockprof.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <getopt.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
@@ -13,48 +18,33 @@
 
 
 
-/* Given a path, fills pointers with strings for the parent path and child
- * file name
- * Input:
- *  - path: the path to split. ATENTION: the function may alter this parameter
- *  - parent: reference to a char*, to store parent path
- *  - child: reference to a char*, to store child file name
- */
-void split_parent_child_from_path(char * path, char ** parent, char ** child) {
+/* lock-free walks tried before walking with locks */
+#define OPTIMISTIC_TRIES 4
 
-	int n_slashes = 0, last_slash_location = 0;
-	int len = strlen(path);
-
-	// deal with trailing slash ( a/x vs a/x/ )
-	if (path[len-1] == '/') {
-		path[len-1] = '\0';
-	}
-
-	for (int i=0; i < len; ++i) {
-		if (path[i] == '/' && path[i+1] != '\0') {
-			last_slash_location = i;
-			n_slashes++;
-		}
-	}
-
-	if (n_slashes == 0) { // root directory
-		*parent = "";
-		*child = path;
-		return;
-	}
-
-	path[last_slash_location] = '\0';
-	*parent = path;
-	*child = path + last_slash_location + 1;
+/*
+ * Whether lookups walk paths without locks first. On by default, disabled
+ * with TECNICOFS_OPTIMISTIC=0. Memory the walks may still be following is
+ * only released through epoch_retire (see epoch.h).
+ */
+static int optimistic_lookups = 1;
 
-}
+/* whether lookups go through the dentry cache, disabled with
+ * TECNICOFS_DCACHE=0 */
+static int cached_lookups = 1;
 
 
 /*
  * Initializes tecnicofs and creates root node.
  */
 void init_fs() {
+	char *optimistic = getenv("TECNICOFS_OPTIMISTIC");
+	char *cached = getenv("TECNICOFS_DCACHE");
+
+	lockprof_init();
 	inode_table_init();
+	dcache_init();
+	optimistic_lookups = optimistic == NULL || strcmp(optimistic, "0") != 0;
+	cached_lookups = cached == NULL || strcmp(cached, "0") != 0;
 
 	/* create root inode */
 	int root = inode_create(T_DIRECTORY);
@@ -70,26 +60,23 @@ void init_fs() {
  * Destroy tecnicofs and inode table.
  */
 void destroy_fs() {
+	dcache_destroy();
 	inode_table_destroy();
+	lockprof_destroy();
 }
 
 
 /*
  * Checks if content of directory is not empty.
  * Input:
- *  - entries: entries of directory
+ *  - dir: entries of directory
  * Returns: SUCCESS or FAIL
  */
 
-int is_dir_empty(DirEntry *dirEntries) {
-	if (dirEntries == NULL) {
+int is_dir_empty(Directory *dir) {
+	if (dir == NULL || !dir_is_empty(dir)) {
 		return FAIL;
 	}
-	for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-		if (dirEntries[i].inumber != FREE_INODE) {
-			return FAIL;
-		}
-	}
 	return SUCCESS;
 }
 
@@ -97,23 +84,17 @@ int is_dir_empty(DirEntry *dirEntries) {
 /*
  * Looks for node in directory entry from name.
  * Input:
- *  - name: path of node
- *  - entries: entries of directory
+ *  - name: path component with the name of the node
+ *  - dir: entries of directory
  * Returns:
  *  - inumber: found node's inumber
  *  - FAIL: if not found
  */
-int lookup_sub_node(char *name, DirEntry *entries) {
-	if (entries == NULL) {
+int lookup_sub_node(PathComponent *name, Directory *dir) {
+	if (dir == NULL) {
 		return FAIL;
 	}
-
-	for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (entries[i].inumber != FREE_INODE && strcmp(entries[i].name, name) == 0) {
-            return entries[i].inumber;
-        }
-    }
-	return FAIL;
+	return dir_lookup(dir, name->name, name->len, name->hash);
 }
 
 
@@ -127,7 +108,8 @@ int lookup_sub_node(char *name, DirEntry *entries) {
 int create(char *name, type nodeType){
 
 	int parent_inumber, child_inumber;
-	char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
+	Path path;
+	PathComponent *child;
 	LockTable table;
 	table.counter = 0;
 
@@ -135,15 +117,19 @@ int create(char *name, type nodeType){
 	type pType;
 	union Data pdata;
 
-	strcpy(name_copy, name);
-	split_parent_child_from_path(name_copy, &parent_name, &child_name);
+	if (path_parse(name, &path) == FAIL || path.depth == 0) {
+		printf("failed to create %s, invalid path\n", name);
+		return FAIL;
+	}
+	child = &path.components[path.depth - 1];
+	int parent_len = path_parent_len(&path);
 
-	parent_inumber = lookup(parent_name, READ, &table);
+	parent_inumber = lookup_path(&path, path.depth - 1, WRITE, &table);
 
 
 	if (parent_inumber == FAIL) {
-		printf("failed to create %s, invalid parent dir %s\n",
-		        name, parent_name);
+		printf("failed to create %s, invalid parent dir %.*s\n",
+		        name, parent_len, name);
 		unlockFromArray(&table);
 		return FAIL;
 	}
@@ -151,16 +137,16 @@ int create(char *name, type nodeType){
 	inode_get(parent_inumber, &pType, &pdata);
 
 	if(pType != T_DIRECTORY) {
-		printf("failed to create %s, parent %s is not a dir\n",
-		        name, parent_name);
+		printf("failed to create %s, parent %.*s is not a dir\n",
+		        name, parent_len, name);
 		unlockFromArray(&table);
 		return FAIL;
 	}
 
 
-	if (lookup_sub_node(child_name, pdata.dirEntries) != FAIL) {
-		printf("failed to create %s, already exists in dir %s\n",
-		       child_name, parent_name);
+	if (lookup_sub_node(child, pdata.dir) != FAIL) {
+		printf("failed to create %.*s, already exists in dir %.*s\n",
+		       child->len, child->name, parent_len, name);
 		unlockFromArray(&table);
 		return FAIL;
 	}
@@ -169,20 +155,22 @@ int create(char *name, type nodeType){
 	/* create node and add entry to folder that contains new node */
 	child_inumber = inode_create(nodeType);
 	if (child_inumber == FAIL) {
-		printf("failed to create %s in  %s, couldn't allocate inode\n",
-		        child_name, parent_name);
+		printf("failed to create %.*s in  %.*s, couldn't allocate inode\n",
+		        child->len, child->name, parent_len, name);
 		unlockFromArray(&table);
 		return FAIL;
 	}
 
 
-	if (dir_add_entry(parent_inumber, child_inumber, child_name) == FAIL) {
-		printf("could not add entry %s in dir %s\n",
-		       child_name, parent_name);
+	if (dir_add_entry(parent_inumber, child_inumber, child) == FAIL) {
+		printf("could not add entry %.*s in dir %.*s\n",
+		       child->len, child->name, parent_len, name);
 
 		unlockFromArray(&table);
 		return FAIL;
 	}
+	/* drops the negative entry of the path, if cached */
+	dcache_invalidate(&path, path.depth);
 	unlockFromArray(&table);
 	return SUCCESS;
 }
@@ -197,7 +185,8 @@ int create(char *name, type nodeType){
 int delete(char *name){
 
 	int parent_inumber, child_inumber;
-	char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
+	Path path;
+	PathComponent *child;
 	LockTable table;
 	table.counter = 0;
 
@@ -205,37 +194,44 @@ int delete(char *name){
 	type pType, cType;
 	union Data pdata, cdata;
 
-	strcpy(name_copy, name);
-	split_parent_child_from_path(name_copy, &parent_name, &child_name);
+	if (path_parse(name, &path) == FAIL || path.depth == 0) {
+		printf("failed to delete %s, invalid path\n", name);
+		return FAIL;
+	}
+	child = &path.components[path.depth - 1];
+	int parent_len = path_parent_len(&path);
 
-	parent_inumber = lookup(parent_name, WRITE, &table);
+	parent_inumber = lookup_path(&path, path.depth - 1, WRITE, &table);
 
 	if (parent_inumber == FAIL) {
-		printf("failed to delete %s, invalid parent dir %s\n",
-		        child_name, parent_name);
+		printf("failed to delete %.*s, invalid parent dir %.*s\n",
+		        child->len, child->name, parent_len, name);
+		unlockFromArray(&table);
 		return FAIL;
 	}
 
 	inode_get(parent_inumber, &pType, &pdata);
 
 	if(pType != T_DIRECTORY) {
-		printf("failed to delete %s, parent %s is not a dir\n",
-		        child_name, parent_name);
+		printf("failed to delete %.*s, parent %.*s is not a dir\n",
+		        child->len, child->name, parent_len, name);
+		unlockFromArray(&table);
 		return FAIL;
 	}
 
-	child_inumber = lookup_sub_node(child_name, pdata.dirEntries);
+	child_inumber = lookup_sub_node(child, pdata.dir);
 
 	if (child_inumber == FAIL) {
-		printf("could not delete %s, does not exist in dir %s\n",
-		       name, parent_name);
+		printf("could not delete %s, does not exist in dir %.*s\n",
+		       name, parent_len, name);
+		unlockFromArray(&table);
 		return FAIL;
 	}
-	lockAndAddToArray(&(inode_table[child_inumber].inodeLock), &table, child_inumber, WRITE);
+	lockAndAddToArray(&(inode_ref(child_inumber)->inodeLock), &table, child_inumber, WRITE);
 
 	inode_get(child_inumber, &cType, &cdata);
 
-	if (cType == T_DIRECTORY && is_dir_empty(cdata.dirEntries) == FAIL) {
+	if (cType == T_DIRECTORY && is_dir_empty(cdata.dir) == FAIL) {
 		printf("could not delete %s: is a directory and not empty\n",
 		       name);
 		unlockFromArray(&table);
@@ -243,16 +239,19 @@ int delete(char *name){
 	}
 
 	/* remove entry from folder that contained deleted node */
-	if (dir_reset_entry(parent_inumber, child_inumber) == FAIL) {
-		printf("failed to delete %s from dir %s\n",
-		       child_name, parent_name);
+	if (dir_reset_entry(parent_inumber, child_inumber, child) == FAIL) {
+		printf("failed to delete %.*s from dir %.*s\n",
+		       child->len, child->name, parent_len, name);
 		unlockFromArray(&table);
 		return FAIL;
 	}
+	/* only empty directories are deleted, so no path below this one can
+	 * be cached as existing */
+	dcache_invalidate(&path, path.depth);
 
 	if (inode_delete(child_inumber) == FAIL) {
-		printf("could not delete inode number %d from dir %s\n",
-		       child_inumber, parent_name);
+		printf("could not delete inode number %d from dir %.*s\n",
+		       child_inumber, parent_len, name);
 		unlockFromArray(&table);
 		return FAIL;
 	}
@@ -265,58 +264,448 @@ int delete(char *name){
  * Lookup for a given path.
  * Input:
  *  - name: path of node
+ *  - operation: READ or WRITE, the lock to return with on the node
+ *  - table: locks held, or NULL to return with no lock (READ only)
  * Returns:
  *  inumber: identifier of the i-node, if found
  *     FAIL: otherwise
  */
 int lookup(char *name, int operation, LockTable *table) {
-	char full_path[MAX_FILE_NAME];
-	char delim[] = "/";
-	char *saveptr;
+	Path path;
 
-	if (operation == READ){
-		table = malloc(sizeof(LockTable));
-		table->counter = 0;
+	if (path_parse(name, &path) == FAIL) {
+		return FAIL;
+	}
+	return lookup_path(&path, path.depth, operation, table);
+}
+
+
+/*
+ * Walks the first components of a parsed path without taking any lock,
+ * validating the sequence counter of every directory read (see
+ * seqlock.h). A child's counter is read before its parent is validated, so
+ * the child was still an entry of the parent at that point. Must be called
+ * inside an epoch critical section.
+ * Input:
+ *  - path: parsed path
+ *  - depth: number of components to follow, 0 for the root
+ *  - generation: reference to store the generation of the i-node found
+ * Returns:
+ *    inumber: identifier of the i-node, if found
+ *       FAIL: otherwise
+ *  DIR_RETRY: a writer changed the path meanwhile
+ */
+static int lookup_optimistic(Path *path, int depth, unsigned int *generation) {
+	int current_inumber = FS_ROOT;
+	inode_t *inode = inode_ref(current_inumber);
+	unsigned int seen = seq_read_begin(&inode->version);
+
+	for (int i = 0; i < depth; i++) {
+		PathComponent *component = &path->components[i];
+		Directory *dir = NULL;
+		int child = FAIL;
+
+		if (__atomic_load_n(&inode->nodeType, __ATOMIC_RELAXED) == T_DIRECTORY) {
+			dir = __atomic_load_n(&inode->data.dir, __ATOMIC_RELAXED);
+		}
+		/* a reused i-node may not have its directory yet, or hold file
+		 * contents in its place: validate before following the pointer */
+		if (seq_read_retry(&inode->version, seen)) {
+			return DIR_RETRY;
+		}
+		if (dir != NULL) {
+			child = dir_lookup_optimistic(dir, component->name, component->len,
+			                              component->hash, &inode->version, seen);
+		}
+		if (child == DIR_RETRY || seq_read_retry(&inode->version, seen)) {
+			return DIR_RETRY;
+		}
+		if (child == FAIL) {
+			return FAIL;
+		}
+
+		inode_t *next = inode_ref(child);
+		unsigned int next_seen = seq_read_begin(&next->version);
+		if (seq_read_retry(&inode->version, seen)) {
+			return DIR_RETRY;
+		}
+		current_inumber = child;
+		inode = next;
+		seen = next_seen;
+	}
+
+	*generation = __atomic_load_n(&inode->generation, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&inode->nodeType, __ATOMIC_RELAXED) == T_NONE ||
+	    seq_read_retry(&inode->version, seen)) {
+		return DIR_RETRY;
+	}
+	return current_inumber;
+}
+
+
+/*
+ * Lookup for the first components of a parsed path. The dentry cache is
+ * checked first, then the path is walked without locks (if enabled). An
+ * i-node found that way and returned with its lock held is checked to
+ * still be the same one after locking it. Otherwise the path is walked
+ * with lock coupling: the lock of each child is taken before the lock of
+ * its parent is released, so at most two locks are held at a time and
+ * writers only wait for readers that are at their i-node.
+ * Input:
+ *  - path: parsed path
+ *  - depth: number of components to follow, 0 for the root
+ *  - operation: READ or WRITE, the lock to return with on the node, in
+ *    table (or, on FAIL, its last ancestor found read locked)
+ *  - table: locks held, or NULL to return with no lock (READ only)
+ * Returns:
+ *  inumber: identifier of the i-node, if found
+ *     FAIL: otherwise
+ */
+int lookup_path(Path *path, int depth, int operation, LockTable *table) {
+	unsigned int generation;
+	DcacheStamp stamp;
+	LockTable readTable;
+	int cached = depth > 0 && cached_lookups;
+
+	int found = cached ? dcache_get(path, depth, &generation, &stamp) : DCACHE_MISS;
+
+	if (found == DCACHE_MISS && optimistic_lookups) {
+		for (int tries = 0; tries < OPTIMISTIC_TRIES && found == DCACHE_MISS; tries++) {
+			epoch_enter();
+			found = lookup_optimistic(path, depth, &generation);
+			epoch_exit();
+			if (found == DIR_RETRY) {
+				found = DCACHE_MISS;
+			}
+			else if (cached) {
+				dcache_put(path, depth, found, generation, stamp);
+			}
+		}
+	}
+
+	if (found != DCACHE_MISS) {
+		if (table == NULL || found == FAIL) {
+			return found;
+		}
+		inode_t *inode = inode_ref(found);
+		lockAndAddToArray(&inode->inodeLock, table, found, operation);
+		/* inode_create reuses i-nodes without their lock, only the counter
+		 * orders this check against it */
+		unsigned int seen = seq_read_begin(&inode->version);
+		if (__atomic_load_n(&inode->nodeType, __ATOMIC_RELAXED) != T_NONE &&
+		    __atomic_load_n(&inode->generation, __ATOMIC_RELAXED) == generation &&
+		    !seq_read_retry(&inode->version, seen)) {
+			return found;
+		}
+		/* reused since it was found, walk the path */
+		unlockFromArray(table);
 	}
 
-	strcpy(full_path, name);
+	if (table == NULL){
+		table = &readTable;
+		table->counter = 0;
+	}
 
 	/* start at root node */
 	int current_inumber = FS_ROOT;
-	lockAndAddToArray(&(inode_table[current_inumber].inodeLock), table, current_inumber, READ);
+	lockAndAddToArray(&(inode_ref(current_inumber)->inodeLock), table, current_inumber,
+	                  depth == 0 ? operation : READ);
 
 	/* use for copy */
 	type nType;
 	union Data data;
 
-	/* get root inode data */
-	inode_get(current_inumber, &nType, &data);
-
-	char *path = strtok_r(full_path, delim, &saveptr);
-
-	while (path != NULL && (current_inumber = lookup_sub_node(path, data.dirEntries)) != FAIL) {
+	for (int i = 0; i < depth; i++) {
 		inode_get(current_inumber, &nType, &data);
-		lockAndAddToArray(&(inode_table[current_inumber].inodeLock), table, current_inumber, READ);
-		path = strtok_r(NULL, delim, &saveptr);
+		int child = lookup_sub_node(&path->components[i], nType == T_DIRECTORY ? data.dir : NULL);
+		if (child == FAIL) {
+			current_inumber = FAIL;
+			break;
+		}
+		/* the child cannot be deleted while its parent is locked */
+		lockAndAddToArray(&(inode_ref(child)->inodeLock), table, child,
+		                  i + 1 == depth ? operation : READ);
+		unlockOneFromArray(table, table->counter - 2);
+		current_inumber = child;
 	}
 
-	if (operation == READ){
+	if (cached) {
+		generation = current_inumber != FAIL ? inode_ref(current_inumber)->generation : 0;
+		dcache_put(path, depth, current_inumber, generation, stamp);
+	}
+
+	if (table == &readTable){
 		unlockFromArray(table);
-		free(table);
 	}
 
 	return current_inumber;
 }
 
 
-void lockAndAddToArray(pthread_rwlock_t *lock, LockTable *table, int inumber, int operation){
-	if (inumber != FAIL){
+/*
+ * Read locks the ancestors of a locked directory, up to the root, so no
+ * move can change its path. Ancestors already in the table are skipped.
+ * The locks are taken bottom-up, against the order of path walks, so only
+ * trylocks are used.
+ * Input:
+ *  - inumber: identifier of the directory, locked in table
+ *  - table: locks held
+ * Returns: SUCCESS, or FAIL if a lock was busy or the directory was moved
+ */
+static int lock_ancestors(int inumber, LockTable *table) {
+	int child = inumber;
+	int parent = __atomic_load_n(&inode_ref(child)->parent, __ATOMIC_ACQUIRE);
+
+	while (parent != FAIL) {
+		if (!isInArray(table, parent)) {
+			if (tryLockAndAddToArray(&(inode_ref(parent)->inodeLock), table, parent, READ) == FAIL) {
+				return FAIL;
+			}
+			/* moved before its parent was locked */
+			if (__atomic_load_n(&inode_ref(child)->parent, __ATOMIC_ACQUIRE) != parent) {
+				return FAIL;
+			}
+		}
+		child = parent;
+		parent = __atomic_load_n(&inode_ref(child)->parent, __ATOMIC_ACQUIRE);
+	}
+	return SUCCESS;
+}
+
+
+/*
+ * Checks if an i-node is a directory or one of its ancestors.
+ * Must be called with the ancestors of the directory locked.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - dir_inumber: identifier of the directory
+ */
+static int is_ancestor(int inumber, int dir_inumber) {
+	for (int i = dir_inumber; i != FAIL; i = inode_ref(i)->parent) {
+		if (i == inumber) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * Write locks the parent directories of both paths of a move, and read
+ * locks their ancestors, so neither path can change until they are
+ * unlocked. The parents are locked in i-number order. Since path walks
+ * lock top-down, every lock taken while another is held is a trylock,
+ * and everything is released when one is busy.
+ * Input:
+ *  - from, to: parsed paths of the move, with at least one component
+ *  - table: empty lock table, where the locks are recorded
+ *  - from_parent, to_parent: references to store the parents
+ * Returns:
+ *    SUCCESS: the parents are locked and are directories
+ *       FAIL: a parent does not exist or is not a directory
+ *  DIR_RETRY: a lock was busy or a path changed, nothing is locked
+ */
+static int lock_move_parents(Path *from, Path *to, LockTable *table,
+                             int *from_parent, int *to_parent) {
+	int source = lookup_path(from, from->depth - 1, READ, NULL);
+	int target = lookup_path(to, to->depth - 1, READ, NULL);
+
+	if (source == FAIL || target == FAIL) {
+		return FAIL;
+	}
+
+	int first = source < target ? source : target;
+	int second = source < target ? target : source;
+	lockAndAddToArray(&(inode_ref(first)->inodeLock), table, first, WRITE);
+	if ((second != first &&
+	     tryLockAndAddToArray(&(inode_ref(second)->inodeLock), table, second, WRITE) == FAIL) ||
+	    lock_ancestors(source, table) == FAIL || lock_ancestors(target, table) == FAIL) {
+		unlockFromArray(table);
+		return DIR_RETRY;
+	}
+
+	/* both paths are locked from the root, so they resolve to the parents
+	 * unless they changed before the locks were taken */
+	unsigned int generation;
+	epoch_enter();
+	int found_source = lookup_optimistic(from, from->depth - 1, &generation);
+	int found_target = lookup_optimistic(to, to->depth - 1, &generation);
+	epoch_exit();
+	if (found_source != source || found_target != target) {
+		unlockFromArray(table);
+		return DIR_RETRY;
+	}
+
+	if (inode_ref(source)->nodeType != T_DIRECTORY || inode_ref(target)->nodeType != T_DIRECTORY) {
+		unlockFromArray(table);
+		return FAIL;
+	}
+	*from_parent = source;
+	*to_parent = target;
+	return SUCCESS;
+}
+
+
+/*
+ * Moves a node to another path, relinking its i-node to the new parent.
+ * The subtree below it is not copied.
+ * Input:
+ *  - from: path of node
+ *  - to: new path of node, which must not exist
+ * Returns: SUCCESS or FAIL
+ */
+int move(char *from, char *to) {
+
+	int from_parent, to_parent, child_inumber, res;
+	Path from_path, to_path;
+	PathComponent *from_name, *to_name;
+	LockTable table;
+	table.counter = 0;
+
+	if (path_parse(from, &from_path) == FAIL || from_path.depth == 0 ||
+	    path_parse(to, &to_path) == FAIL || to_path.depth == 0) {
+		printf("failed to move %s to %s, invalid path\n", from, to);
+		return FAIL;
+	}
+	from_name = &from_path.components[from_path.depth - 1];
+	to_name = &to_path.components[to_path.depth - 1];
+
+	while ((res = lock_move_parents(&from_path, &to_path, &table, &from_parent, &to_parent)) == DIR_RETRY) {
+		sched_yield();
+	}
+	if (res == FAIL) {
+		printf("failed to move %s to %s, invalid parent dir\n", from, to);
+		return FAIL;
+	}
+
+	child_inumber = lookup_sub_node(from_name, inode_ref(from_parent)->data.dir);
+
+	if (child_inumber == FAIL) {
+		printf("could not move %s, does not exist\n", from);
+		unlockFromArray(&table);
+		return FAIL;
+	}
+
+	if (lookup_sub_node(to_name, inode_ref(to_parent)->data.dir) != FAIL) {
+		printf("could not move %s to %s, already exists\n", from, to);
+		unlockFromArray(&table);
+		return FAIL;
+	}
+
+	if (is_ancestor(child_inumber, to_parent)) {
+		printf("could not move %s into its own subtree %s\n", from, to);
+		unlockFromArray(&table);
+		return FAIL;
+	}
+
+	/* the new entry is added first, so lock-free lookups never find the
+	 * node detached from the tree */
+	if (dir_add_entry(to_parent, child_inumber, to_name) == FAIL) {
+		printf("could not add entry %.*s in dir %.*s\n",
+		       to_name->len, to_name->name, path_parent_len(&to_path), to);
+		unlockFromArray(&table);
+		return FAIL;
+	}
+	if (dir_reset_entry(from_parent, child_inumber, from_name) == FAIL) {
+		printf("failed to remove %.*s from dir %.*s\n",
+		       from_name->len, from_name->name, path_parent_len(&from_path), from);
+	}
+	/* every cached path below the source and the target changed */
+	dcache_invalidate_subtree(&from_path, from_path.depth);
+	dcache_invalidate_subtree(&to_path, to_path.depth);
+	unlockFromArray(&table);
+	return SUCCESS;
+}
+
+
+/*
+ * Writes to a file given its path, growing it if needed. The file is
+ * write locked, so reads of it see the write whole or not at all.
+ * Input:
+ *  - name: path of the file
+ *  - buf: bytes to write
+ *  - len: number of bytes
+ *  - offset: position in the file
+ * Returns: number of bytes written, or FAIL
+ */
+int write_file(char *name, char *buf, size_t len, size_t offset){
+	LockTable table;
+	table.counter = 0;
+
+	int inumber = lookup(name, WRITE, &table);
+	int res = inumber != FAIL ? inode_write(inumber, buf, len, offset) : FAIL;
+
+	if (res == FAIL) {
+		printf("failed to write to %s\n", name);
+	}
+	unlockFromArray(&table);
+	return res;
+}
+
+
+/*
+ * Reads from a file given its path.
+ * Input:
+ *  - name: path of the file
+ *  - buf: buffer of at least len bytes
+ *  - len: number of bytes
+ *  - offset: position in the file
+ * Returns: number of bytes read (0 past the end), or FAIL
+ */
+int read_file(char *name, char *buf, size_t len, size_t offset){
+	LockTable table;
+	table.counter = 0;
+
+	int inumber = lookup(name, READ, &table);
+	int res = inumber != FAIL ? inode_read(inumber, buf, len, offset) : FAIL;
+
+	unlockFromArray(&table);
+	return res;
+}
+
+
+/*
+ * Describes a range of a file given its path as buffers pointing into its
+ * contents, to send it without copying (see file_read_iov). On success the
+ * file is left read locked in table, and the buffers are valid until it is
+ * released with unlockFromArray.
+ * Input:
+ *  - name: path of the file
+ *  - offset: position in the file
+ *  - len: number of bytes wanted
+ *  - iov: array to fill
+ *  - iovcnt: number of entries of iov
+ *  - table: empty lock table
+ * Returns: number of entries filled, or FAIL (with nothing locked)
+ */
+int read_file_iov(char *name, size_t offset, size_t len, struct iovec *iov, int iovcnt,
+                  LockTable *table){
+	int inumber = lookup(name, READ, table);
+	int res = inumber != FAIL ? inode_read_iov(inumber, offset, len, iov, iovcnt) : FAIL;
+
+	if (res == FAIL) {
+		unlockFromArray(table);
+	}
+	return res;
+}
+
+
+/*
+ * Locks an i-node and records it in a lock table.
+ * Input:
+ *  - lock: lock of the i-node
+ *  - table: locks held
+ *  - inumber: identifier of the i-node
+ *  - operation: WRITE for a write lock, READ for a read lock
+ */
+void lockAndAddToArray(BravoLock *lock, LockTable *table, int inumber, int operation){
+	if (inumber != FAIL && table->counter < LOCK_TABLE_SIZE){
 		if (operation == WRITE){
-			if (pthread_rwlock_rdlock(lock) != 0)
+			if (lockprof_wrlock(lock, inumber) != 0)
 				perror("Error: Cannot lock rwlock.");
 		}
 		if (operation == READ){
-			if (pthread_rwlock_rdlock(lock) != 0)
+			if (lockprof_rdlock(lock, inumber) != 0)
 				perror("Error: Cannot lock rwlock.");
 		}
 		table->inode_numbers[table->counter] = inumber;
@@ -326,13 +715,65 @@ void lockAndAddToArray(pthread_rwlock_t *lock, LockTable *table, int inumber, in
 		printf("Erro: lockAndAddToArray\n");
 }
 
+/*
+ * Tries to lock an i-node without waiting, and records it in a lock
+ * table if it was locked.
+ * Input:
+ *  - lock: lock of the i-node
+ *  - table: locks held
+ *  - inumber: identifier of the i-node
+ *  - operation: WRITE for a write lock, READ for a read lock
+ * Returns: SUCCESS, or FAIL if the lock is busy or the table is full
+ */
+int tryLockAndAddToArray(BravoLock *lock, LockTable *table, int inumber, int operation){
+	if (inumber == FAIL || table->counter == LOCK_TABLE_SIZE)
+		return FAIL;
+	if (operation == WRITE && lockprof_trywrlock(lock, inumber) != 0)
+		return FAIL;
+	if (operation == READ && lockprof_tryrdlock(lock, inumber) != 0)
+		return FAIL;
+	table->inode_numbers[table->counter] = inumber;
+	table->counter++;
+	return SUCCESS;
+}
+
+/*
+ * Checks if an i-node is locked in a lock table.
+ */
+int isInArray(LockTable *table, int inumber){
+	for (int i = 0; i < table->counter; i++)
+		if (table->inode_numbers[i] == inumber)
+			return 1;
+	return 0;
+}
+
+/*
+ * Releases one of the locks of a lock table.
+ * Input:
+ *  - table: locks held
+ *  - index: position of the lock in the table
+ */
+void unlockOneFromArray(LockTable *table, int index){
+	int current_inumber = table->inode_numbers[index];
+
+	if (lockprof_rwunlock(&(inode_ref(current_inumber)->inodeLock), current_inumber) != 0)
+		perror("Error: Cannot unlock rwlock.");
+	for (int i = index + 1; i < table->counter; i++)
+		table->inode_numbers[i - 1] = table->inode_numbers[i];
+	table->counter--;
+}
+
+/*
+ * Releases every lock of a lock table, leaving it empty.
+ */
 void unlockFromArray(LockTable *table){
 	int current_inumber;
 	for (int i = 0; i < table->counter; i++){
 		current_inumber = table->inode_numbers[i];
-		if (pthread_rwlock_unlock(&(inode_table[current_inumber].inodeLock)) != 0)
+		if (lockprof_rwunlock(&(inode_ref(current_inumber)->inodeLock), current_inumber) != 0)
 			perror("Error: Cannot unlock rwlock.");
 	}
+	table->counter = 0;
 }
 
 
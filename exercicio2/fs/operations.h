@@ -2,21 +2,37 @@
 #define FS_H
 
 #include "state.h"
+#include "path.h"
 
+/*
+ * Locks held by an operation. Paths are walked with lock coupling, so an
+ * operation holds a parent and a child at most, except for move, which
+ * holds two parents and all of their ancestors.
+ */
+#define LOCK_TABLE_SIZE (2 * MAX_PATH_DEPTH)
 
 typedef struct inode_LockTable{
-    int inode_numbers[INODE_TABLE_SIZE];
+    int inode_numbers[LOCK_TABLE_SIZE];
 	int counter;
 } LockTable;
 
 void init_fs();
 void destroy_fs();
-int is_dir_empty(DirEntry *dirEntries);
+int is_dir_empty(Directory *dir);
 int create(char *name, type nodeType);
 int delete(char *name);
+int move(char *from, char *to);
 int lookup(char *name, int operation, LockTable *table);
+int lookup_path(Path *path, int depth, int operation, LockTable *table);
+int write_file(char *name, char *buf, size_t len, size_t offset);
+int read_file(char *name, char *buf, size_t len, size_t offset);
+int read_file_iov(char *name, size_t offset, size_t len, struct iovec *iov, int iovcnt,
+                  LockTable *table);
 void print_tecnicofs_tree(FILE *fp);
-void lockAndAddToArray(pthread_rwlock_t *lock, LockTable *table, int inumber, int operation);
+void lockAndAddToArray(BravoLock *lock, LockTable *table, int inumber, int operation);
+int tryLockAndAddToArray(BravoLock *lock, LockTable *table, int inumber, int operation);
+int isInArray(LockTable *table, int inumber);
+void unlockOneFromArray(LockTable *table, int index);
 void unlockFromArray(LockTable *table);
 
 
@@ -0,0 +1,43 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include "../tecnicofs-api-constants.h"
+
+/* a path of MAX_FILE_NAME chars has at most this many components plus root */
+#define MAX_PATH_DEPTH (MAX_FILE_NAME / 2 + 1)
+
+/* FNV-1a, the hash of entry names and cached paths */
+#define PATH_HASH_INIT 2166136261u
+#define PATH_HASH_STEP(hash, c) (((hash) ^ (unsigned char) (c)) * 16777619u)
+
+
+/*
+ * A component of a parsed path. The name points into the parsed string
+ * and is not NUL terminated.
+ */
+typedef struct pathComponent {
+	char *name;
+	int len;
+	unsigned int hash;          /* hash of the name */
+	int prefix_len;             /* length of the canonical path up to here */
+	unsigned int prefix_hash;   /* hash of the canonical path up to here */
+} PathComponent;
+
+/*
+ * A path split into its components. The canonical form of a path has its
+ * components separated by a single '/', with no leading or trailing slash;
+ * the root is the empty path.
+ */
+typedef struct path {
+	char *name;     /* the parsed string */
+	int depth;      /* number of components */
+	PathComponent components[MAX_PATH_DEPTH];
+} Path;
+
+
+int path_parse(char *name, Path *path);
+int path_prefix_matches(Path *path, int depth, char *canonical, int len);
+void path_copy_prefix(Path *path, int depth, char *canonical);
+int path_parent_len(Path *path);
+
+#endif /* PATH_H */
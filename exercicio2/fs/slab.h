@@ -0,0 +1,29 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Size-class allocator for directory blocks and file payloads.
+ * Objects of SLAB_MIN_SIZE << c bytes (class c) are carved from SLAB_SIZE
+ * slabs and recycled through per-class free lists. Every thread keeps a
+ * magazine of up to SLAB_MAGAZINE_SIZE free objects per class, so most
+ * allocations and frees take no lock. Sizes above SLAB_MAX_SIZE go to
+ * malloc.
+ */
+#define SLAB_MIN_SHIFT 6
+#define SLAB_MIN_SIZE (1 << SLAB_MIN_SHIFT)
+#define SLAB_CLASSES 9
+#define SLAB_MAX_SIZE (SLAB_MIN_SIZE << (SLAB_CLASSES - 1))
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_MAGAZINE_SIZE 32
+
+
+void slab_init();
+void slab_destroy();
+void *slab_alloc(size_t size);
+void slab_free(void *ptr, size_t size);
+void slab_print_stats(FILE *fp);
+
+#endif /* SLAB_H */
@@ -9,29 +9,57 @@
 #include <sys/syscall.h>
 #include "state.h"
 #include "operations.h"
+#include "slab.h"
+#include "namepool.h"
+#include "epoch.h"
+#include "lockprof.h"
+#include "dirscan.h"
 #include "../tecnicofs-api-constants.h"
 
 
 
 
+/* set by inode_table_init, TECNICOFS_DELAY=0 turns insert_delay off */
+static int delay_enabled = 1;
+
 /*
  * Sleeps for synchronization testing.
  */
 void insert_delay(int cycles) {
+    if (!delay_enabled) {
+        return;
+    }
     for (int i = 0; i < cycles; i++) {}
 }
 
 
+inode_t *inode_chunks[INODE_MAX_CHUNKS];
+
+/* number of i-nodes in allocated chunks, published after the chunk */
+static int inode_capacity = 0;
+
+/* head of the free i-node list, protected by inode_alloc_lock */
+static int free_head = FREE_INODE;
+static pthread_mutex_t inode_alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
 /*
  * Initializes the i-nodes table.
  */
 void inode_table_init() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        inode_table[i].nodeType = T_NONE;
-        inode_table[i].data.dirEntries = NULL;
-        inode_table[i].data.fileContents = NULL;
-        pthread_rwlock_init(&(inode_table[i].inodeLock), NULL);
+    char *delay = getenv("TECNICOFS_DELAY");
+
+    delay_enabled = delay == NULL || strcmp(delay, "0") != 0;
+    bravo_configure();
+    slab_init();
+    epoch_init();
+    namepool_init();
+    dirscan_init();
+    for (int c = 0; c < INODE_MAX_CHUNKS; c++) {
+        inode_chunks[c] = NULL;
     }
+    inode_capacity = 0;
+    free_head = FREE_INODE;
 }
 
 /*
@@ -39,15 +67,74 @@ void inode_table_init() {
  */
 
 void inode_table_destroy() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        if (inode_table[i].nodeType != T_NONE) {
-            /* as data is an union, the same pointer is used for both dirEntries and fileContents */
-            /* just release one of them */
-	        if (inode_table[i].data.dirEntries)
-                free(inode_table[i].data.dirEntries);
-            pthread_rwlock_destroy(&inode_table[i].inodeLock);
+    int capacity = inode_capacity;
+
+    for (int i = 0; i < capacity; i++) {
+        inode_t *inode = inode_ref(i);
+        if (inode->nodeType != T_NONE) {
+            if (inode->nodeType == T_DIRECTORY)
+                dir_destroy(inode->data.dir);
+            else
+                file_destroy(&inode->data.file);
         }
+        bravo_destroy(&inode->inodeLock);
+    }
+    for (int c = 0; c < capacity / INODE_CHUNK_SIZE; c++) {
+        free(inode_chunks[c]);
+        inode_chunks[c] = NULL;
     }
+    inode_capacity = 0;
+    free_head = FREE_INODE;
+    /* directories destroyed above were only retired */
+    epoch_destroy();
+    namepool_destroy();
+    slab_destroy();
+}
+
+/*
+ * Allocates a new chunk of i-nodes and threads it into the free list.
+ * Must be called with inode_alloc_lock held.
+ * Returns: SUCCESS or FAIL
+ */
+static int inode_table_grow() {
+    int chunk = inode_capacity / INODE_CHUNK_SIZE;
+
+    if (chunk == INODE_MAX_CHUNKS) {
+        return FAIL;
+    }
+
+    inode_t *inodes;
+    if (posix_memalign((void **) &inodes, 64, sizeof(inode_t) * INODE_CHUNK_SIZE) != 0) {
+        return FAIL;
+    }
+
+    int first = chunk * INODE_CHUNK_SIZE;
+    for (int i = 0; i < INODE_CHUNK_SIZE; i++) {
+        inodes[i].nodeType = T_NONE;
+        file_init(&inodes[i].data.file);
+        bravo_init(&inodes[i].inodeLock);
+        inodes[i].generation = 0;
+        inodes[i].version = 0;
+        /* lower inumbers are handed out first */
+        inodes[i].nextFree = (i + 1 < INODE_CHUNK_SIZE) ? first + i + 1 : free_head;
+    }
+
+    inode_chunks[chunk] = inodes;
+    free_head = first;
+    /* readers check inumbers against the capacity, publish the chunk first */
+    __atomic_store_n(&inode_capacity, first + INODE_CHUNK_SIZE, __ATOMIC_RELEASE);
+    return SUCCESS;
+}
+
+/*
+ * Checks if an inumber identifies an i-node in use.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: 1 if the i-node exists, 0 otherwise
+ */
+int inode_exists(int inumber) {
+    return inumber >= 0 && inumber < __atomic_load_n(&inode_capacity, __ATOMIC_ACQUIRE) &&
+           __atomic_load_n(&inode_ref(inumber)->nodeType, __ATOMIC_RELAXED) != T_NONE;
 }
 
 /*
@@ -62,25 +149,37 @@ int inode_create(type nType) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if (inode_table[inumber].nodeType == T_NONE) {
-            inode_table[inumber].nodeType = nType;
-
-            if (nType == T_DIRECTORY) {
-                /* Initializes entry table */
-                inode_table[inumber].data.dirEntries = malloc(sizeof(DirEntry) * MAX_DIR_ENTRIES);
-
-                for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-                    inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-                }
-            }
-            else {
-                inode_table[inumber].data.fileContents = NULL;
-            }
-            return inumber;
+    lockprof_mutex_lock(&inode_alloc_lock, LOCKPROF_INODE_ALLOC);
+    if (free_head == FREE_INODE && inode_table_grow() == FAIL) {
+        lockprof_mutex_unlock(&inode_alloc_lock, LOCKPROF_INODE_ALLOC);
+        return FAIL;
+    }
+    int inumber = free_head;
+    inode_t *inode = inode_ref(inumber);
+    free_head = inode->nextFree;
+    /* lock-free readers holding a stale inumber see it change */
+    seq_write_begin(&inode->version);
+    /* read by lock-free readers, within the counter */
+    __atomic_store_n(&inode->nodeType, nType, __ATOMIC_RELAXED);
+    __atomic_store_n(&inode->generation, inode->generation + 1, __ATOMIC_RELAXED);
+    inode->parent = FAIL;
+    lockprof_mutex_unlock(&inode_alloc_lock, LOCKPROF_INODE_ALLOC);
+
+    if (nType == T_DIRECTORY) {
+        /* Initializes entry table */
+        __atomic_store_n(&inode->data.dir, dir_create(), __ATOMIC_RELAXED);
+
+        if (inode->data.dir == NULL) {
+            seq_write_end(&inode->version);
+            inode_delete(inumber);
+            return FAIL;
         }
     }
-    return FAIL;
+    else {
+        file_init(&inode->data.file);
+    }
+    seq_write_end(&inode->version);
+    return inumber;
 }
 
 /*
@@ -93,15 +192,25 @@ int inode_delete(int inumber) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_exists(inumber)) {
         printf("inode_delete: invalid inumber\n");
         return FAIL;
     }
 
-    inode_table[inumber].nodeType = T_NONE;
+    inode_t *inode = inode_ref(inumber);
+    seq_write_begin(&inode->version);
     /* see inode_table_destroy function */
-    if (inode_table[inumber].data.dirEntries)
-        free(inode_table[inumber].data.dirEntries);
+    if (inode->nodeType == T_DIRECTORY)
+        dir_destroy(inode->data.dir);
+    else
+        file_destroy(&inode->data.file);
+
+    lockprof_mutex_lock(&inode_alloc_lock, LOCKPROF_INODE_ALLOC);
+    __atomic_store_n(&inode->nodeType, T_NONE, __ATOMIC_RELAXED);
+    seq_write_end(&inode->version);
+    inode->nextFree = free_head;
+    free_head = inumber;
+    lockprof_mutex_unlock(&inode_alloc_lock, LOCKPROF_INODE_ALLOC);
 
     return SUCCESS;
 }
@@ -118,100 +227,174 @@ int inode_delete(int inumber) {
 int inode_get(int inumber, type *nType, union Data *data) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_exists(inumber)) {
         printf("inode_get: invalid inumber %d\n", inumber);
         return FAIL;
     }
 
     if (nType)
-        *nType = inode_table[inumber].nodeType;
+        *nType = inode_ref(inumber)->nodeType;
 
     if (data)
-        *data = inode_table[inumber].data;
+        *data = inode_ref(inumber)->data;
     return SUCCESS;
 }
 
 
 
 
+/*
+ * Returns the contents of a file i-node, or NULL (printing why) if the
+ * inumber does not identify a file.
+ */
+static FileData *inode_file(int inumber, char *caller) {
+    if (!inode_exists(inumber)) {
+        printf("%s: invalid inumber %d\n", caller, inumber);
+        return NULL;
+    }
+    if (inode_ref(inumber)->nodeType != T_FILE) {
+        printf("%s: inumber %d is not a file\n", caller, inumber);
+        return NULL;
+    }
+    return &inode_ref(inumber)->data.file;
+}
+
+/*
+ * Writes to a file at an offset, growing it if needed.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - buf: bytes to write
+ *  - len: number of bytes
+ *  - offset: position in the file
+ * Returns: number of bytes written, or FAIL
+ */
+int inode_write(int inumber, char *buf, size_t len, size_t offset) {
+    FileData *file = inode_file(inumber, "inode_write");
+
+    if (file == NULL) {
+        return FAIL;
+    }
+    return file_write(file, buf, len, offset);
+}
+
+/*
+ * Reads from a file at an offset.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - buf: buffer of at least len bytes
+ *  - len: number of bytes
+ *  - offset: position in the file
+ * Returns: number of bytes read (0 past the end), or FAIL
+ */
+int inode_read(int inumber, char *buf, size_t len, size_t offset) {
+    FileData *file = inode_file(inumber, "inode_read");
+
+    if (file == NULL) {
+        return FAIL;
+    }
+    return file_read(file, buf, len, offset);
+}
+
+/*
+ * Describes a range of a file as buffers pointing into its contents, to
+ * send it without copying (see file_read_iov). The i-node lock must be
+ * held while the buffers are used.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - offset: position in the file
+ *  - len: number of bytes wanted
+ *  - iov: array to fill
+ *  - iovcnt: number of entries of iov
+ * Returns: number of entries filled, or FAIL
+ */
+int inode_read_iov(int inumber, size_t offset, size_t len, struct iovec *iov, int iovcnt) {
+    FileData *file = inode_file(inumber, "inode_read_iov");
+
+    if (file == NULL) {
+        return FAIL;
+    }
+    return file_read_iov(file, offset, len, iov, iovcnt);
+}
+
+
 /*
  * Resets an entry for a directory.
  * Input:
  *  - inumber: identifier of the i-node
  *  - sub_inumber: identifier of the sub i-node entry
+ *  - sub_name: name of the sub i-node entry
  * Returns: SUCCESS or FAIL
  */
-int dir_reset_entry(int inumber, int sub_inumber) {
+int dir_reset_entry(int inumber, int sub_inumber, PathComponent *sub_name) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_exists(inumber)) {
         printf("inode_reset_entry: invalid inumber\n");
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
+    if (inode_ref(inumber)->nodeType != T_DIRECTORY) {
         printf("inode_reset_entry: can only reset entry to directories\n");
         return FAIL;
     }
 
-    if ((sub_inumber < FREE_INODE) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
+    if (!inode_exists(sub_inumber)) {
         printf("inode_reset_entry: invalid entry inumber\n");
         return FAIL;
     }
 
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == sub_inumber) {
-            inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-            inode_table[inumber].data.dirEntries[i].name[0] = '\0';
-            return SUCCESS;
-        }
-    }
-    return FAIL;
+    inode_t *inode = inode_ref(inumber);
+    seq_write_begin(&inode->version);
+    int res = dir_remove(inode->data.dir, sub_name->name, sub_name->len, sub_name->hash, sub_inumber);
+    seq_write_end(&inode->version);
+    return res;
 }
 
 
 /*
- * Adds an entry to the i-node directory data.
+ * Adds an entry to the i-node directory data, and makes the directory the
+ * parent of the sub i-node. Must be called with the directory write
+ * locked, which is what protects the parent of the sub i-node.
  * Input:
  *  - inumber: identifier of the i-node
  *  - sub_inumber: identifier of the sub i-node entry
  *  - sub_name: name of the sub i-node entry
  * Returns: SUCCESS or FAIL
  */
-int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
+int dir_add_entry(int inumber, int sub_inumber, PathComponent *sub_name) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_exists(inumber)) {
         printf("inode_add_entry: invalid inumber\n");
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
+    if (inode_ref(inumber)->nodeType != T_DIRECTORY) {
         printf("inode_add_entry: can only add entry to directories\n");
         return FAIL;
     }
 
-    if ((sub_inumber < 0) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
+    if (!inode_exists(sub_inumber)) {
         printf("inode_add_entry: invalid entry inumber\n");
         return FAIL;
     }
 
-    if (strlen(sub_name) == 0 ) {
+    if (sub_name->len == 0) {
         printf("inode_add_entry: \
                entry name must be non-empty\n");
         return FAIL;
     }
 
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == FREE_INODE) {
-            inode_table[inumber].data.dirEntries[i].inumber = sub_inumber;
-            strcpy(inode_table[inumber].data.dirEntries[i].name, sub_name);
-            return SUCCESS;
-        }
+    inode_t *inode = inode_ref(inumber);
+    seq_write_begin(&inode->version);
+    int res = dir_insert(inode->data.dir, sub_name->name, sub_name->len, sub_name->hash, sub_inumber);
+    seq_write_end(&inode->version);
+    if (res == SUCCESS) {
+        __atomic_store_n(&inode_ref(sub_inumber)->parent, inumber, __ATOMIC_RELEASE);
     }
-    return FAIL;
+    return res;
 }
 
 
@@ -222,21 +405,21 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
  *  - name: pointer to the name of current file/dir
  */
 void inode_print_tree(FILE *fp, int inumber, char *name) {
-    if (inode_table[inumber].nodeType == T_FILE) {
+    if (inode_ref(inumber)->nodeType == T_FILE) {
         fprintf(fp, "%s\n", name);
         return;
     }
 
-    if (inode_table[inumber].nodeType == T_DIRECTORY) {
+    if (inode_ref(inumber)->nodeType == T_DIRECTORY) {
         fprintf(fp, "%s\n", name);
-        for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-            if (inode_table[inumber].data.dirEntries[i].inumber != FREE_INODE) {
-                char path[MAX_FILE_NAME];
-                if (snprintf(path, sizeof(path), "%s/%s", name, inode_table[inumber].data.dirEntries[i].name) > sizeof(path)) {
-                    fprintf(stderr, "truncation when building full path\n");
-                }
-                inode_print_tree(fp, inode_table[inumber].data.dirEntries[i].inumber, path);
+        char sub_name[MAX_FILE_NAME];
+        int cursor = 0, sub_inumber;
+        while ((sub_inumber = dir_next_entry(inode_ref(inumber)->data.dir, &cursor, sub_name)) != FAIL) {
+            char path[MAX_FILE_NAME];
+            if (snprintf(path, sizeof(path), "%s/%s", name, sub_name) > sizeof(path)) {
+                fprintf(stderr, "truncation when building full path\n");
             }
+            inode_print_tree(fp, sub_inumber, path);
         }
     }
 }
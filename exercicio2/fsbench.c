@@ -0,0 +1,900 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "fs/operations.h"
+#include "fs/state.h"
+#include "fs/dirscan.h"
+#include "queue.h"
+#include "bench.h"
+
+/*
+ * Microbenchmarks of the parts of the file system and of the command
+ * queue, run on their own rather than through a trace. Each mode prints
+ * one JSON object per line, one per point measured, with times from the
+ * monotonic clock (see bench.h).
+ * The artificial delay of the i-node operations is off (see insert_delay).
+ *
+ *  churn [max_exponent] [rounds]: i-node create/delete cost with 10^2 up to
+ *      10^max_exponent live i-nodes
+ *  write [max_size]: throughput of sequential and random writes of 64 B up
+ *      to max_size bytes, filling files of max_size bytes
+ *  tree [depth] [threads] [read_percent]: throughput of lookups mixed with
+ *      creates and deletes in a chain of depth directories, for each number
+ *      of threads of a list such as 1,2,4; TECNICOFS_OPTIMISTIC=0 and
+ *      TECNICOFS_DCACHE=0 leave only the walks with lock coupling, and
+ *      TECNICOFS_BRAVO=0 makes their locks plain read-write locks
+ *  queue [producers] [consumers] [capacities] [batch]: throughput of the
+ *      command queue for every combination of the numbers in the lists
+ *  recycle [seconds] [readers]: stress test of the lock-free walks, which
+ *      look up /d/x while a writer keeps reusing the i-node of /d as a
+ *      directory and as a file; exits with a failure if a lookup goes wrong
+ *  scan [entries] [kernels]: cost of a lookup that finds its entry and of
+ *      one that does not, in a directory of each number of entries of a
+ *      list, with each set of scan kernels of a list such as scalar,avx2
+ *      (the names of TECNICOFS_SCAN, by default all the CPU supports)
+ *  sharing [records] [reads]: cost of reading the traversal fields of
+ *      adjacent i-nodes while another thread locks and unlocks them, with
+ *      the i-node layout and with the former one, where the lock shared
+ *      the traversal line; counts cache misses with perf_event_open when
+ *      there is a PMU, and only times the reads otherwise
+ */
+#define CHURN_MAX_EXPONENT 7
+#define CHURN_ROUNDS 200000
+
+#define WRITE_MIN_SIZE 64
+#define WRITE_MAX_SIZE (64 << 20)
+/* bytes written at each size, in files of max_size bytes */
+#define WRITE_TOTAL (256 << 20)
+
+#define TREE_DEPTH 32
+#define TREE_THREADS "1,2,4,8,16,32,64"
+#define TREE_READ_PERCENT 90
+#define TREE_MAX_THREADS 256
+/* files looked up in each directory of the chain */
+#define TREE_FILES 8
+/* operations of a run, shared by its threads */
+#define TREE_OPS 400000
+
+#define QUEUE_PRODUCERS "1,4"
+#define QUEUE_CONSUMERS "1,4"
+#define QUEUE_CAPACITIES "2,16,1024"
+/* commands of a run, shared by its producers */
+#define QUEUE_ITEMS 2000000
+#define RECYCLE_SECONDS 5
+#define RECYCLE_READERS 4
+
+/* flat arrays up to DIR_INLINE_MAX entries, hash tables past it */
+#define SCAN_ENTRIES "1,4,8,16,24,32,33,64,256,4096,65536"
+#define SCAN_KERNELS "scalar,sse2,avx2"
+#define SCAN_MAX_ENTRIES (1 << 20)
+/* lookups timed at each point, of each kind */
+#define SCAN_LOOKUPS 2000000
+
+/* 64 records of either layout fit in L1, so misses come from sharing */
+#define SHARING_RECORDS 64
+#define SHARING_MAX_RECORDS 4096
+#define SHARING_READS 20000000
+
+/* most numbers in a list */
+#define FSBENCH_MAX_LIST 64
+
+
+static void displayUsage(const char *appName) {
+    printf("Usage: %s churn [max_exponent] [rounds]\n"
+           "       %s write [max_size]\n"
+           "       %s tree [depth] [threads] [read_percent]\n"
+           "       %s queue [producers] [consumers] [capacities] [batch]\n"
+           "       %s recycle [seconds] [readers]\n"
+           "       %s scan [entries] [kernels]\n"
+           "       %s sharing [records] [reads]\n"
+           "  threads, producers, consumers, capacities and entries are lists, as 1,2,4\n"
+           "  kernels is a list of scan kernels, as scalar,sse2,avx2\n",
+           appName, appName, appName, appName, appName, appName, appName);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Returns: the next number of a xorshift generator, so runs are repeatable
+ */
+static unsigned long fsbench_random(unsigned long *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/*
+ * Parses a list of positive numbers, as 1,2,4.
+ * Input:
+ *  - values: array of FSBENCH_MAX_LIST numbers to store them
+ *  - limit: largest number allowed
+ * Returns: number of numbers, 0 if the list is empty or invalid
+ */
+static int fsbench_list(const char *list, int *values, int limit) {
+    char copy[strlen(list) + 1];
+    int n = 0;
+
+    strcpy(copy, list);
+    for (char *value = strtok(copy, ","); value != NULL; value = strtok(NULL, ",")) {
+        if (n == FSBENCH_MAX_LIST || (values[n] = atoi(value)) <= 0 || values[n] > limit) {
+            return 0;
+        }
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Grows the i-node table through 10^2, 10^3, ... live i-nodes and, at
+ * each size, deletes a live i-node and creates one in its place, rounds
+ * times: first with victims among a hundred, then among them all. The
+ * first cost should not depend on the size; the second also pays for a
+ * cache miss once the table outgrows the cache.
+ */
+static void runChurn(int maxExponent, int rounds) {
+    long maxLive = 1;
+    unsigned long seed = 88172645463325252ul;
+
+    for (int e = 0; e < maxExponent; e++) {
+        maxLive *= 10;
+    }
+    int *live = malloc(maxLive * sizeof(int));
+    if (live == NULL) {
+        perror("Error: can't allocate i-numbers.");
+        exit(EXIT_FAILURE);
+    }
+    init_fs();
+    long count = 0;
+    for (long size = 100; size <= maxLive; size *= 10) {
+        long created = size - count;
+        unsigned long start = bench_now();
+        for (; count < size; count++) {
+            if ((live[count] = inode_create(T_FILE)) == FAIL) {
+                fprintf(stderr, "Error: can't create i-node %ld.\n", count);
+                exit(EXIT_FAILURE);
+            }
+        }
+        double fill = (double) (bench_now() - start) / created;
+
+        /* victims among the first 100 only, which stay in the cache: the
+         * cost of the free list and the table, without reaching a random
+         * i-node of a larger table */
+        start = bench_now();
+        for (int i = 0; i < rounds; i++) {
+            long victim = fsbench_random(&seed) % 100;
+            inode_delete(live[victim]);
+            live[victim] = inode_create(T_FILE);
+        }
+        double hot = (double) (bench_now() - start) / (2.0 * rounds);
+
+        start = bench_now();
+        for (int i = 0; i < rounds; i++) {
+            long victim = fsbench_random(&seed) % size;
+            inode_delete(live[victim]);
+            live[victim] = inode_create(T_FILE);
+        }
+        double churn = (double) (bench_now() - start) / (2.0 * rounds);
+
+        printf("{\"mode\": \"churn\", \"live\": %ld, \"rounds\": %d, "
+               "\"fill_ns\": %.1f, \"op_ns\": %.1f, \"hot_op_ns\": %.1f}\n",
+               size, rounds, fill, churn, hot);
+        fflush(stdout);
+    }
+    destroy_fs();
+    free(live);
+}
+
+/*
+ * Fills files of fileSize bytes with writes of size bytes, until total
+ * bytes are written. Each file is new, so every write allocates the pages
+ * it covers; only the writes are timed.
+ * Input:
+ *  - order: offsets of the writes of a file, in units of size
+ *  - blocks: number of writes of a file
+ * Returns: throughput, in MB/s
+ */
+static double fsbench_fill(long *order, long blocks, size_t size, char *buf, long total) {
+    unsigned long ns = 0;
+
+    for (long written = 0; written < total; written += blocks * size) {
+        int inumber = inode_create(T_FILE);
+        if (inumber == FAIL) {
+            fprintf(stderr, "Error: can't create a file.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        unsigned long start = bench_now();
+        for (long i = 0; i < blocks; i++) {
+            if (inode_write(inumber, buf, size, order[i] * size) != size) {
+                fprintf(stderr, "Error: can't write %zu bytes.\n", size);
+                exit(EXIT_FAILURE);
+            }
+        }
+        ns += bench_now() - start;
+        inode_delete(inumber);
+    }
+    return ns > 0 ? (double) total * 1000 / ns : 0;
+}
+
+/*
+ * Writes files of maxSize bytes sequentially and in a random order, with
+ * writes of 64 B, 256 B, ... up to maxSize bytes. The random order writes
+ * every block of the file once, so both orders write the same bytes.
+ */
+static void runWrite(long maxSize) {
+    long maxBlocks = maxSize / WRITE_MIN_SIZE;
+    long *sequential = malloc(maxBlocks * sizeof(long));
+    long *shuffled = malloc(maxBlocks * sizeof(long));
+    char *buf = malloc(maxSize);
+    unsigned long seed = 88172645463325252ul;
+
+    if (sequential == NULL || shuffled == NULL || buf == NULL) {
+        perror("Error: can't allocate buffers.");
+        exit(EXIT_FAILURE);
+    }
+    memset(buf, 'x', maxSize);
+    init_fs();
+    for (long size = WRITE_MIN_SIZE; size <= maxSize; size *= 4) {
+        long blocks = maxSize / size;
+        long total = maxSize > WRITE_TOTAL ? maxSize : WRITE_TOTAL;
+
+        for (long i = 0; i < blocks; i++) {
+            sequential[i] = shuffled[i] = i;
+        }
+        for (long i = blocks - 1; i > 0; i--) {
+            long j = fsbench_random(&seed) % (i + 1);
+            long swap = shuffled[i];
+            shuffled[i] = shuffled[j];
+            shuffled[j] = swap;
+        }
+
+        double seq = fsbench_fill(sequential, blocks, size, buf, total);
+        double rnd = fsbench_fill(shuffled, blocks, size, buf, total);
+        printf("{\"mode\": \"write\", \"size\": %ld, \"file_size\": %ld, "
+               "\"sequential_mb_s\": %.0f, \"random_mb_s\": %.0f}\n",
+               size, maxSize, seq, rnd);
+        fflush(stdout);
+    }
+    destroy_fs();
+    free(sequential);
+    free(shuffled);
+    free(buf);
+}
+
+typedef struct treeWorker {
+    pthread_t thread;
+    int id;
+    long ops;
+} TreeWorker;
+
+static int treeDepth;
+static int treeReadPercent;
+static pthread_barrier_t treeStart;
+
+
+/*
+ * Writes the path of a name in the directory at a level of the chain,
+ * /a/a/.../a/name, the root being level 0.
+ */
+static void fsbench_tree_path(char *path, int level, const char *name) {
+    for (int i = 0; i < level; i++) {
+        *path++ = '/';
+        *path++ = 'a';
+    }
+    sprintf(path, "/%s", name);
+}
+
+/*
+ * Returns: 1 unless the variable of a setting is 0, as init_fs reads it
+ */
+static int fsbench_setting(const char *variable) {
+    char *value = getenv(variable);
+
+    return value == NULL || strcmp(value, "0") != 0;
+}
+
+/*
+ * Runs a worker's share of the operations: lookups of a random file at a
+ * random level, or else the create of a file of its own at a random level
+ * or the delete of the one it created.
+ */
+static void *runTreeWorker(void *arg) {
+    TreeWorker *worker = (TreeWorker *) arg;
+    unsigned long seed = 88172645463325252ul ^ ((worker->id + 1) * 0x9e3779b97f4a7c15ul);
+    char path[MAX_FILE_NAME], name[16], file[16];
+    int level = -1;     /* of the file of the worker, -1 if it has none */
+
+    snprintf(name, sizeof(name), "w%d", worker->id);
+    pthread_barrier_wait(&treeStart);
+    for (long i = 0; i < worker->ops; i++) {
+        unsigned long r = fsbench_random(&seed);
+        int res;
+
+        if (r % 100 < treeReadPercent) {
+            snprintf(file, sizeof(file), "f%lu", (r >> 8) % TREE_FILES);
+            fsbench_tree_path(path, (r >> 16) % (treeDepth + 1), file);
+            res = lookup(path, READ, NULL);
+        }
+        else if (level < 0) {
+            level = (r >> 16) % (treeDepth + 1);
+            fsbench_tree_path(path, level, name);
+            res = create(path, T_FILE);
+        }
+        else {
+            fsbench_tree_path(path, level, name);
+            res = delete(path);
+            level = -1;
+        }
+        if (res == FAIL) {
+            fprintf(stderr, "Error: %s failed.\n", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (level >= 0) {
+        fsbench_tree_path(path, level, name);
+        delete(path);
+    }
+    return NULL;
+}
+
+/*
+ * Builds a chain of depth directories, with TREE_FILES files in each, and
+ * runs TREE_OPS operations on it with each number of threads.
+ * Input:
+ *  - threadCounts: array of n numbers of threads
+ */
+static void runTree(int depth, int *threadCounts, int n, int readPercent) {
+    char path[MAX_FILE_NAME], file[16];
+
+    treeDepth = depth;
+    treeReadPercent = readPercent;
+    init_fs();
+    for (int level = 0; level <= depth; level++) {
+        if (level > 0) {
+            fsbench_tree_path(path, level - 1, "a");
+            create(path, T_DIRECTORY);
+        }
+        for (int f = 0; f < TREE_FILES; f++) {
+            snprintf(file, sizeof(file), "f%d", f);
+            fsbench_tree_path(path, level, file);
+            create(path, T_FILE);
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        int threads = threadCounts[i];
+        TreeWorker *workers = malloc(threads * sizeof(TreeWorker));
+
+        if (workers == NULL) {
+            perror("Error: can't allocate workers.");
+            exit(EXIT_FAILURE);
+        }
+        pthread_barrier_init(&treeStart, NULL, threads + 1);
+        for (int t = 0; t < threads; t++) {
+            workers[t].id = t;
+            workers[t].ops = TREE_OPS / threads + (t < TREE_OPS % threads);
+            if (pthread_create(&workers[t].thread, NULL, runTreeWorker, &workers[t]) != 0) {
+                perror("Error: can't create thread.");
+                exit(EXIT_FAILURE);
+            }
+        }
+        pthread_barrier_wait(&treeStart);
+        unsigned long start = bench_now();
+        for (int t = 0; t < threads; t++) {
+            pthread_join(workers[t].thread, NULL);
+        }
+        double seconds = (bench_now() - start) / 1e9;
+        pthread_barrier_destroy(&treeStart);
+        free(workers);
+
+        printf("{\"mode\": \"tree\", \"depth\": %d, \"read_percent\": %d, "
+               "\"optimistic\": %s, \"dcache\": %s, \"bravo\": %s, \"threads\": %d, "
+               "\"ops\": %d, \"seconds\": %.4f, \"ops_per_sec\": %.0f}\n",
+               depth, readPercent, fsbench_setting("TECNICOFS_OPTIMISTIC") ? "true" : "false",
+               fsbench_setting("TECNICOFS_DCACHE") ? "true" : "false",
+               fsbench_setting("TECNICOFS_BRAVO") ? "true" : "false",
+               threads, TREE_OPS, seconds, TREE_OPS / seconds);
+        fflush(stdout);
+    }
+    destroy_fs();
+}
+
+typedef struct queueWorker {
+    pthread_t thread;
+    long first;         /* tickets of a producer, from first to last - 1 */
+    long last;
+    unsigned long count;    /* of a consumer: commands and sum of tickets */
+    unsigned long sum;
+} QueueWorker;
+
+static CommandQueue benchQueue;
+static int queueBatch;
+static pthread_barrier_t queueStart;
+
+
+static void *runQueueProducer(void *arg) {
+    QueueWorker *worker = (QueueWorker *) arg;
+    Command command;
+
+    memset(&command, 0, sizeof(Command));
+    command.op = 'l';
+    pthread_barrier_wait(&queueStart);
+    for (long ticket = worker->first; ticket < worker->last; ticket++) {
+        command.ticket = ticket;
+        queue_enqueue(&benchQueue, &command);
+    }
+    return NULL;
+}
+
+static void *runQueueConsumer(void *arg) {
+    QueueWorker *worker = (QueueWorker *) arg;
+    Command *batch = malloc(queueBatch * sizeof(Command));
+    int n;
+
+    if (batch == NULL) {
+        perror("Error: can't allocate batch.");
+        exit(EXIT_FAILURE);
+    }
+    pthread_barrier_wait(&queueStart);
+    while ((n = queue_dequeue(&benchQueue, batch, queueBatch, NULL)) > 0) {
+        for (int i = 0; i < n; i++) {
+            worker->sum += batch[i].ticket;
+        }
+        worker->count += n;
+    }
+    free(batch);
+    return NULL;
+}
+
+/*
+ * Passes QUEUE_ITEMS commands from producers to consumers through a queue
+ * of a capacity, and checks that each was taken once.
+ */
+static void runQueue(int producers, int consumers, int capacity, int batch) {
+    int threads = producers + consumers;
+    QueueWorker *workers = calloc(threads, sizeof(QueueWorker));
+
+    if (workers == NULL || !queue_init(&benchQueue, capacity)) {
+        perror("Error: can't allocate queue.");
+        exit(EXIT_FAILURE);
+    }
+    queueBatch = batch;
+    pthread_barrier_init(&queueStart, NULL, threads + 1);
+    for (int t = 0; t < threads; t++) {
+        QueueWorker *worker = &workers[t];
+        void *(*body)(void *) = t < producers ? runQueueProducer : runQueueConsumer;
+
+        if (t < producers) {
+            worker->first = (long) QUEUE_ITEMS * t / producers;
+            worker->last = (long) QUEUE_ITEMS * (t + 1) / producers;
+        }
+        if (pthread_create(&worker->thread, NULL, body, worker) != 0) {
+            perror("Error: can't create thread.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_barrier_wait(&queueStart);
+    unsigned long start = bench_now();
+    for (int t = 0; t < producers; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    queue_close(&benchQueue);
+    unsigned long count = 0, sum = 0;
+    for (int t = producers; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        count += workers[t].count;
+        sum += workers[t].sum;
+    }
+    double seconds = (bench_now() - start) / 1e9;
+    pthread_barrier_destroy(&queueStart);
+
+    if (count != QUEUE_ITEMS || sum != (unsigned long) QUEUE_ITEMS * (QUEUE_ITEMS - 1) / 2) {
+        fprintf(stderr, "Error: %lu commands taken of %d.\n", count, QUEUE_ITEMS);
+        exit(EXIT_FAILURE);
+    }
+    /* the capacity is rounded up to a power of two */
+    printf("{\"mode\": \"queue\", \"producers\": %d, \"consumers\": %d, "
+           "\"capacity\": %lu, \"batch\": %d, \"items\": %d, \"seconds\": %.4f, "
+           "\"ops_per_sec\": %.0f}\n",
+           producers, consumers, benchQueue.mask + 1, batch, QUEUE_ITEMS, seconds,
+           QUEUE_ITEMS / seconds);
+    fflush(stdout);
+    queue_destroy(&benchQueue);
+    free(workers);
+}
+
+typedef struct recycleReader {
+    pthread_t thread;
+    unsigned long lookups;
+    unsigned long found;
+} RecycleReader;
+
+static int recycleDone = 0;
+
+
+static void *runRecycleReader(void *arg) {
+    RecycleReader *reader = (RecycleReader *) arg;
+
+    while (!__atomic_load_n(&recycleDone, __ATOMIC_RELAXED)) {
+        int inumber = lookup("/d/x", READ, NULL);
+        /* only the root, /d and /d/x are ever in use, as 0, 1 and 2 */
+        if (inumber != FAIL && (inumber <= FS_ROOT || inumber > 2)) {
+            fprintf(stderr, "Error: /d/x found as i-node %d.\n", inumber);
+            exit(EXIT_FAILURE);
+        }
+        reader->lookups++;
+        reader->found += inumber != FAIL;
+    }
+    return NULL;
+}
+
+/*
+ * Runs readers that walk /d/x without locks (the dentry cache is off)
+ * while this thread creates and deletes /d as a directory holding x, then
+ * as a file. The free list hands the same i-nodes back, so the i-node of
+ * /d keeps changing type under the readers. A walk that used a directory
+ * before validating it crashes, or finds an i-number never given to x.
+ */
+static void runRecycle(int seconds, int readers) {
+    RecycleReader *threads = calloc(readers, sizeof(RecycleReader));
+    unsigned long cycles = 0;
+
+    if (threads == NULL) {
+        perror("Error: can't allocate readers.");
+        exit(EXIT_FAILURE);
+    }
+    setenv("TECNICOFS_DCACHE", "0", 1);
+    setenv("TECNICOFS_OPTIMISTIC", "1", 1);
+    init_fs();
+    for (int t = 0; t < readers; t++) {
+        if (pthread_create(&threads[t].thread, NULL, runRecycleReader, &threads[t]) != 0) {
+            perror("Error: can't create thread.");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    unsigned long end = bench_now() + seconds * 1000000000ul;
+    while (bench_now() < end) {
+        if (create("/d", T_DIRECTORY) == FAIL || create("/d/x", T_FILE) == FAIL ||
+            delete("/d/x") == FAIL || delete("/d") == FAIL ||
+            create("/d", T_FILE) == FAIL || delete("/d") == FAIL) {
+            fprintf(stderr, "Error: cycle %lu failed.\n", cycles);
+            exit(EXIT_FAILURE);
+        }
+        cycles++;
+    }
+    __atomic_store_n(&recycleDone, 1, __ATOMIC_RELAXED);
+
+    unsigned long lookups = 0, found = 0;
+    for (int t = 0; t < readers; t++) {
+        pthread_join(threads[t].thread, NULL);
+        lookups += threads[t].lookups;
+        found += threads[t].found;
+    }
+    printf("{\"mode\": \"recycle\", \"seconds\": %d, \"readers\": %d, \"cycles\": %lu, "
+           "\"lookups\": %lu, \"found\": %lu}\n", seconds, readers, cycles, lookups, found);
+    destroy_fs();
+    free(threads);
+}
+
+typedef struct scanName {
+    char chars[16];
+    int len;
+    unsigned int hash;
+} ScanName;
+
+/*
+ * Fills a directory with entries and times random lookups in it, of names
+ * it holds and of names it does not, with the kernels selected. A flat
+ * array is scanned whole by a lookup; a hash table only along the groups
+ * of its probe sequence. The names are made beforehand: f0, f1, ... are
+ * in the directory, m0, m1, ... are missing.
+ */
+static void runScan(int entries) {
+    ScanName *names = malloc(2 * entries * sizeof(ScanName));
+    Directory *dir = dir_create();
+    unsigned long seed = 88172645463325252ul;
+
+    if (names == NULL || dir == NULL) {
+        perror("Error: can't allocate directory.");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < 2 * entries; i++) {
+        ScanName *name = &names[i];
+        name->len = sprintf(name->chars, "%c%d", i < entries ? 'f' : 'm', i % entries);
+        /* hashed as path_parse does */
+        name->hash = PATH_HASH_INIT;
+        for (int c = 0; c < name->len; c++) {
+            name->hash = PATH_HASH_STEP(name->hash, name->chars[c]);
+        }
+        if (i < entries && dir_insert(dir, name->chars, name->len, name->hash, i + 1) == FAIL) {
+            fprintf(stderr, "Error: can't insert entry %d.\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    double ns[2];
+    for (int missing = 0; missing <= 1; missing++) {
+        unsigned long start = bench_now();
+        for (int i = 0; i < SCAN_LOOKUPS; i++) {
+            int entry = fsbench_random(&seed) % entries;
+            ScanName *name = &names[missing * entries + entry];
+            int found = dir_lookup(dir, name->chars, name->len, name->hash);
+            if (found != (missing ? FAIL : entry + 1)) {
+                fprintf(stderr, "Error: lookup of %s returned %d.\n", name->chars, found);
+                exit(EXIT_FAILURE);
+            }
+        }
+        ns[missing] = (double) (bench_now() - start) / SCAN_LOOKUPS;
+    }
+    printf("{\"mode\": \"scan\", \"kernel\": \"%s\", \"entries\": %d, "
+           "\"layout\": \"%s\", \"capacity\": %d, \"hit_ns\": %.1f, \"miss_ns\": %.1f}\n",
+           dirscan.name, entries, dir->hashed ? "hash" : "flat", dir->capacity, ns[0], ns[1]);
+    fflush(stdout);
+    dir_destroy(dir);
+    free(names);
+}
+
+/*
+ * The i-node of 144 bytes, before its lock got a cache line of its own:
+ * the traversal fields, the lock and the cold fields packed together, so
+ * the lock of an i-node shares lines with the traversal fields of it and
+ * of its neighbours.
+ */
+typedef struct packedInode {
+    unsigned int version;
+    type nodeType;
+    unsigned int generation;
+    int parent;
+    union Data data;
+    BravoLock inodeLock;
+    int nextFree;
+} PackedInode;
+
+typedef struct sharingLayout {
+    const char *name;
+    size_t size;            /* bytes of a record */
+    size_t lock;            /* offset of its lock */
+    /* sum of the traversal fields of a record */
+    unsigned long (*read)(char *record);
+} SharingLayout;
+
+static unsigned long sharingReadInode(char *record) {
+    volatile inode_t *inode = (inode_t *) record;
+    return inode->version + inode->nodeType + inode->generation + inode->parent +
+           (unsigned long) inode->data.dir;
+}
+
+static unsigned long sharingReadPacked(char *record) {
+    volatile PackedInode *inode = (PackedInode *) record;
+    return inode->version + inode->nodeType + inode->generation + inode->parent +
+           (unsigned long) inode->data.dir;
+}
+
+static SharingLayout sharingLayouts[] = {
+    { "split", sizeof(inode_t), offsetof(inode_t, inodeLock), sharingReadInode },
+    { "packed", sizeof(PackedInode), offsetof(PackedInode, inodeLock), sharingReadPacked },
+};
+
+typedef struct sharingRun {
+    SharingLayout *layout;
+    char *records;
+    int count;
+    int done;
+} SharingRun;
+
+/*
+ * Opens a counter of the cache misses of the calling thread.
+ * Returns: its descriptor, or -1 if the kernel or the machine has none
+ */
+static int sharingCounter() {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * Locks and unlocks every record in turn, for writing, until the reader
+ * is done.
+ */
+static void *runSharingWriter(void *arg) {
+    SharingRun *run = (SharingRun *) arg;
+
+    while (!__atomic_load_n(&run->done, __ATOMIC_RELAXED)) {
+        for (int i = 0; i < run->count; i++) {
+            BravoLock *lock = (BravoLock *) (run->records + i * run->layout->size + run->layout->lock);
+            bravo_wrlock(lock);
+            bravo_unlock(lock);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Reads the traversal fields of records of a layout, reads times, with or
+ * without a writer locking them meanwhile, and prints the time per read
+ * and the cache misses per read (null without a counter).
+ */
+static void runSharing(SharingLayout *layout, int count, long reads, int writer) {
+    SharingRun run = { layout, NULL, count, 0 };
+    pthread_t thread;
+    /* keeps the reads from being optimized away */
+    volatile unsigned long sum = 0;
+    long long misses = 0;
+
+    if (posix_memalign((void **) &run.records, 64, count * layout->size) != 0) {
+        perror("Error: can't allocate records.");
+        exit(EXIT_FAILURE);
+    }
+    memset(run.records, 0, count * layout->size);
+    for (int i = 0; i < count; i++) {
+        bravo_init((BravoLock *) (run.records + i * layout->size + layout->lock));
+    }
+    if (writer && pthread_create(&thread, NULL, runSharingWriter, &run) != 0) {
+        perror("Error: can't create thread.");
+        exit(EXIT_FAILURE);
+    }
+
+    int counter = sharingCounter();
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    unsigned long start = bench_now();
+    for (long i = 0; i < reads; i++) {
+        sum += layout->read(run.records + (i % count) * layout->size);
+    }
+    double ns = (double) (bench_now() - start) / reads;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+            misses = -1;
+        }
+        close(counter);
+    }
+
+    __atomic_store_n(&run.done, 1, __ATOMIC_RELAXED);
+    if (writer) {
+        pthread_join(thread, NULL);
+    }
+    printf("{\"mode\": \"sharing\", \"layout\": \"%s\", \"record_size\": %zu, "
+           "\"records\": %d, \"writer\": %d, \"cpus\": %ld, \"reads\": %ld, "
+           "\"ns_per_read\": %.2f, ",
+           layout->name, layout->size, count, writer, sysconf(_SC_NPROCESSORS_ONLN), reads, ns);
+    if (counter >= 0 && misses >= 0) {
+        printf("\"misses_per_read\": %.4f}\n", (double) misses / reads);
+    }
+    else {
+        printf("\"misses_per_read\": null}\n");
+    }
+    fflush(stdout);
+    for (int i = 0; i < count; i++) {
+        bravo_destroy((BravoLock *) (run.records + i * layout->size + layout->lock));
+    }
+    free(run.records);
+}
+
+int main(int argc, char *argv[]) {
+    /* the busy loop of insert_delay would hide what is measured, unless
+     * TECNICOFS_DELAY is set */
+    setenv("TECNICOFS_DELAY", "0", 0);
+    if (argc < 2) {
+        displayUsage(argv[0]);
+    }
+
+    if (strcmp(argv[1], "churn") == 0 && argc <= 4) {
+        int maxExponent = argc > 2 ? atoi(argv[2]) : CHURN_MAX_EXPONENT;
+        int rounds = argc > 3 ? atoi(argv[3]) : CHURN_ROUNDS;
+        if (maxExponent < 2 || maxExponent > 7 || rounds <= 0) {
+            displayUsage(argv[0]);
+        }
+        runChurn(maxExponent, rounds);
+    }
+    else if (strcmp(argv[1], "write") == 0 && argc <= 3) {
+        long maxSize = argc > 2 ? atol(argv[2]) : WRITE_MAX_SIZE;
+        if (maxSize < WRITE_MIN_SIZE || maxSize > INT_MAX) {
+            displayUsage(argv[0]);
+        }
+        runWrite(maxSize);
+    }
+    else if (strcmp(argv[1], "tree") == 0 && argc <= 5) {
+        int depth = argc > 2 ? atoi(argv[2]) : TREE_DEPTH;
+        char *list = argc > 3 ? argv[3] : TREE_THREADS;
+        int readPercent = argc > 4 ? atoi(argv[4]) : TREE_READ_PERCENT;
+        int threadCounts[FSBENCH_MAX_LIST];
+        int n = fsbench_list(list, threadCounts, TREE_MAX_THREADS);
+
+        /* /a/a/.../a/f0 must fit in a path */
+        if (n == 0 || depth < 1 || 2 * depth + 4 >= MAX_FILE_NAME ||
+            readPercent < 0 || readPercent > 100) {
+            displayUsage(argv[0]);
+        }
+        runTree(depth, threadCounts, n, readPercent);
+    }
+    else if (strcmp(argv[1], "queue") == 0 && argc <= 6) {
+        int producers[FSBENCH_MAX_LIST], consumers[FSBENCH_MAX_LIST], capacities[FSBENCH_MAX_LIST];
+        int np = fsbench_list(argc > 2 ? argv[2] : QUEUE_PRODUCERS, producers, TREE_MAX_THREADS);
+        int nc = fsbench_list(argc > 3 ? argv[3] : QUEUE_CONSUMERS, consumers, TREE_MAX_THREADS);
+        int ncap = fsbench_list(argc > 4 ? argv[4] : QUEUE_CAPACITIES, capacities, 1 << 24);
+        int batch = argc > 5 ? atoi(argv[5]) : QUEUE_DEFAULT_BATCH;
+
+        if (np == 0 || nc == 0 || ncap == 0 || batch <= 0) {
+            displayUsage(argv[0]);
+        }
+        for (int p = 0; p < np; p++) {
+            for (int c = 0; c < nc; c++) {
+                for (int cap = 0; cap < ncap; cap++) {
+                    runQueue(producers[p], consumers[c], capacities[cap], batch);
+                }
+            }
+        }
+    }
+    else if (strcmp(argv[1], "recycle") == 0 && argc <= 4) {
+        int seconds = argc > 2 ? atoi(argv[2]) : RECYCLE_SECONDS;
+        int readers = argc > 3 ? atoi(argv[3]) : RECYCLE_READERS;
+
+        if (seconds <= 0 || readers <= 0 || readers > TREE_MAX_THREADS) {
+            displayUsage(argv[0]);
+        }
+        runRecycle(seconds, readers);
+    }
+    else if (strcmp(argv[1], "scan") == 0 && argc <= 4) {
+        int entries[FSBENCH_MAX_LIST];
+        int n = fsbench_list(argc > 2 ? argv[2] : SCAN_ENTRIES, entries, SCAN_MAX_ENTRIES);
+        char *list = argc > 3 ? argv[3] : SCAN_KERNELS;
+        char kernels[strlen(list) + 1];
+
+        if (n == 0) {
+            displayUsage(argv[0]);
+        }
+        init_fs();
+        strcpy(kernels, list);
+        for (char *kernel = strtok(kernels, ","); kernel != NULL; kernel = strtok(NULL, ",")) {
+            if (dirscan_select(kernel) == FAIL) {
+                fprintf(stderr, "Skipping %s: unknown or not supported by this CPU.\n", kernel);
+                continue;
+            }
+            for (int i = 0; i < n; i++) {
+                runScan(entries[i]);
+            }
+        }
+        destroy_fs();
+    }
+    else if (strcmp(argv[1], "sharing") == 0 && argc <= 4) {
+        int records = argc > 2 ? atoi(argv[2]) : SHARING_RECORDS;
+        long reads = argc > 3 ? atol(argv[3]) : SHARING_READS;
+
+        if (records <= 0 || records > SHARING_MAX_RECORDS || reads <= 0) {
+            displayUsage(argv[0]);
+        }
+        int counter = sharingCounter();
+        if (counter < 0) {
+            fprintf(stderr, "No cache miss counter, timing the reads only.\n");
+        }
+        else {
+            close(counter);
+        }
+        for (int l = 0; l < sizeof(sharingLayouts) / sizeof(sharingLayouts[0]); l++) {
+            runSharing(&sharingLayouts[l], records, reads, 0);
+            runSharing(&sharingLayouts[l], records, reads, 1);
+        }
+    }
+    else {
+        displayUsage(argv[0]);
+    }
+    exit(EXIT_SUCCESS);
+}
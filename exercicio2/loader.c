@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "loader.h"
+#include "fs/state.h"
+#include "fs/timer.h"
+
+/* longest line taken: a move of two paths of MAX_FILE_NAME - 1 chars */
+#define LOADER_LINE_SIZE (COMMAND_TEXT_SIZE + 8)
+#define LOADER_STREAM_BUFFER (64 * 1024)
+
+
+typedef struct loader {
+    const char *data;
+    size_t size;
+    unsigned long segments;
+    unsigned long next;             /* next segment to parse */
+    unsigned long turn;             /* next segment to add to the sink */
+    int stopped;                    /* a q or an invalid line was added */
+    int result;
+    CommandSink put;                /* where the commands go */
+    void *sink;
+    pthread_mutex_t lock;
+    pthread_cond_t turnChanged;
+    unsigned long lines;
+    unsigned long commands;
+} Loader;
+
+/* commands parsed from a segment, kept by its parser until its turn */
+typedef struct segment {
+    Command *commands;
+    int count;
+    int capacity;
+    int end;        /* SUCCESS, or why the segment ended early: 'q' or LOADER_INVALID */
+} Segment;
+
+
+/*
+ * Returns: a free command at the end of a segment
+ */
+static Command *segment_next(Segment *segment) {
+    if (segment->count == segment->capacity) {
+        segment->capacity = segment->capacity > 0 ? 2 * segment->capacity : 1024;
+        segment->commands = realloc(segment->commands, segment->capacity * sizeof(Command));
+        if (segment->commands == NULL) {
+            perror("Error: can't allocate commands.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return &segment->commands[segment->count];
+}
+
+/*
+ * Parses a line of the input.
+ * Input:
+ *  - start, len: the line, with its newline if it has one
+ *  - command: reference to store the command
+ * Returns: SUCCESS or LOADER_INVALID
+ */
+static int parse_line(const char *start, size_t len, Command *command) {
+    char line[LOADER_LINE_SIZE];
+
+    if (len >= LOADER_LINE_SIZE) {
+        return LOADER_INVALID;
+    }
+    memcpy(line, start, len);
+    line[len] = '\0';
+    /* there is no output file to print to */
+    if (command_parse(line, command) == FAIL || command->op == 'p') {
+        return LOADER_INVALID;
+    }
+    return SUCCESS;
+}
+
+/*
+ * Parses the lines that start in a segment of the file.
+ * Input:
+ *  - loader: the loader
+ *  - index: index of the segment
+ *  - segment: reference to store the commands
+ */
+static void parse_segment(Loader *loader, unsigned long index, Segment *segment) {
+    size_t pos = index * LOADER_SEGMENT_SIZE;
+    size_t end = pos + LOADER_SEGMENT_SIZE;
+    unsigned long lines = 0;
+
+    if (end > loader->size) {
+        end = loader->size;
+    }
+    /* the line cut by the start of the segment is the previous one's */
+    if (pos > 0 && loader->data[pos - 1] != '\n') {
+        const char *newline = memchr(loader->data + pos, '\n', loader->size - pos);
+        pos = newline != NULL ? (size_t) (newline - loader->data) + 1 : loader->size;
+    }
+
+    segment->count = 0;
+    segment->end = SUCCESS;
+    while (pos < end) {
+        const char *start = loader->data + pos;
+        const char *newline = memchr(start, '\n', loader->size - pos);
+        size_t len = newline != NULL ? (size_t) (newline - start) + 1 : loader->size - pos;
+
+        pos += len;
+        lines++;
+
+        Command *command = segment_next(segment);
+        if (parse_line(start, len, command) == LOADER_INVALID) {
+            segment->end = LOADER_INVALID;
+            break;
+        }
+        if (command->op == 'q') {
+            segment->end = 'q';
+            break;
+        }
+        if (command->op != '#') {
+            segment->count++;
+        }
+    }
+    __atomic_add_fetch(&loader->lines, lines, __ATOMIC_RELAXED);
+}
+
+/*
+ * Parses segments and adds their commands to the sink, each when the
+ * segments before it are in.
+ */
+static void *parse_segments(void *arg) {
+    Loader *loader = (Loader *) arg;
+    Segment segment;
+
+    memset(&segment, 0, sizeof(segment));
+    for (;;) {
+        unsigned long index = __atomic_fetch_add(&loader->next, 1, __ATOMIC_RELAXED);
+        if (index >= loader->segments) {
+            break;
+        }
+        /* nothing after the end is added, no point parsing it */
+        if (!__atomic_load_n(&loader->stopped, __ATOMIC_RELAXED)) {
+            parse_segment(loader, index, &segment);
+        }
+
+        pthread_mutex_lock(&loader->lock);
+        while (loader->turn != index) {
+            pthread_cond_wait(&loader->turnChanged, &loader->lock);
+        }
+        pthread_mutex_unlock(&loader->lock);
+
+        if (!__atomic_load_n(&loader->stopped, __ATOMIC_RELAXED)) {
+            loader->put(loader->sink, segment.commands, segment.count);
+            loader->commands += segment.count;
+            if (segment.end != SUCCESS) {
+                loader->result = segment.end == LOADER_INVALID ? LOADER_INVALID : SUCCESS;
+                __atomic_store_n(&loader->stopped, 1, __ATOMIC_RELAXED);
+            }
+        }
+
+        pthread_mutex_lock(&loader->lock);
+        loader->turn++;
+        pthread_cond_broadcast(&loader->turnChanged);
+        pthread_mutex_unlock(&loader->lock);
+    }
+    free(segment.commands);
+    return NULL;
+}
+
+
+/*
+ * Adds the commands of a stream to a sink as they arrive, by a single
+ * thread. While the sink blocks nothing is read, so a writer faster than
+ * the workers blocks on the pipe.
+ * Input:
+ *  - fd: the stream
+ *  - put, sink: where the commands go
+ *  - stats: counters of the load
+ * Returns: SUCCESS, FAIL if reading fails, or LOADER_INVALID
+ */
+static int load_stream(int fd, CommandSink put, void *sink, LoaderStats *stats) {
+    char buffer[LOADER_STREAM_BUFFER];
+    size_t filled = 0;
+    int eof = 0;
+    Command command;
+
+    while (!eof) {
+        ssize_t n = read(fd, buffer + filled, sizeof(buffer) - filled);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FAIL;
+        }
+        stats->bytes += n;
+        filled += n;
+        /* the last line may have no newline */
+        eof = n == 0;
+
+        char *start = buffer;
+        char *end = buffer + filled;
+        while (start < end) {
+            char *newline = memchr(start, '\n', end - start);
+            size_t len = newline != NULL ? (size_t) (newline - start) + 1 : (size_t) (end - start);
+
+            if (newline == NULL && !eof) {
+                if (len >= LOADER_LINE_SIZE) {
+                    return LOADER_INVALID;
+                }
+                break;
+            }
+            stats->lines++;
+            if (parse_line(start, len, &command) == LOADER_INVALID) {
+                return LOADER_INVALID;
+            }
+            if (command.op == 'q') {
+                return SUCCESS;
+            }
+            if (command.op != '#') {
+                put(sink, &command, 1);
+                stats->commands++;
+            }
+            start += len;
+        }
+        filled = end - start;
+        memmove(buffer, start, filled);
+    }
+    return SUCCESS;
+}
+
+
+/*
+ * Adds the commands of a trace file to a sink, in order, from a single
+ * thread at a time. Pipes, sockets and terminals are read as streams, see
+ * load_stream.
+ * Input:
+ *  - path: path of the file, "-" for the standard input
+ *  - put, sink: where the commands go, put(sink, commands, n)
+ *  - parsers: number of threads parsing, the caller included
+ *  - stats: reference to store the counters of the load
+ * Returns: SUCCESS, FAIL if the file can't be read, or LOADER_INVALID
+ */
+int load_commands(char *path, CommandSink put, void *sink, int parsers, LoaderStats *stats) {
+    TIMER_T start, stop;
+    Loader loader;
+    struct stat st;
+    pthread_t *threads;
+    int fd;
+
+    TIMER_READ(start);
+    memset(stats, 0, sizeof(LoaderStats));
+    fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return FAIL;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        int res = load_stream(fd, put, sink, stats);
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        TIMER_READ(stop);
+        stats->seconds = TIMER_DIFF_SECONDS(start, stop);
+        return res;
+    }
+    memset(&loader, 0, sizeof(loader));
+    loader.size = st.st_size;
+    loader.put = put;
+    loader.sink = sink;
+    loader.result = SUCCESS;
+    if (loader.size > 0) {
+        loader.data = mmap(NULL, loader.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (loader.data == MAP_FAILED) {
+            close(fd);
+            return FAIL;
+        }
+        madvise((void *) loader.data, loader.size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    loader.segments = (loader.size + LOADER_SEGMENT_SIZE - 1) / LOADER_SEGMENT_SIZE;
+    pthread_mutex_init(&loader.lock, NULL);
+    pthread_cond_init(&loader.turnChanged, NULL);
+
+    threads = malloc(parsers * sizeof(pthread_t));
+    if (threads == NULL) {
+        perror("Error: can't allocate parsers.");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 1; i < parsers; i++) {
+        if (pthread_create(&threads[i], NULL, parse_segments, &loader) != 0) {
+            perror("Error: can't create thread.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    parse_segments(&loader);
+    for (int i = 1; i < parsers; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
+            perror("Error: can't join thread.");
+        }
+    }
+    free(threads);
+
+    pthread_mutex_destroy(&loader.lock);
+    pthread_cond_destroy(&loader.turnChanged);
+    if (loader.size > 0) {
+        munmap((void *) loader.data, loader.size);
+    }
+    TIMER_READ(stop);
+    stats->bytes = loader.size;
+    stats->lines = loader.lines;
+    stats->commands = loader.commands;
+    stats->seconds = TIMER_DIFF_SECONDS(start, stop);
+    return loader.result;
+}
+
+void loader_print_stats(FILE *fp, LoaderStats *stats) {
+    double mb = stats->bytes / (1024.0 * 1024.0);
+
+    fprintf(fp, "loader: %.1f MB, %lu lines, %lu commands in %.4f seconds (%.1f MB/s)\n",
+            mb, stats->lines, stats->commands, stats->seconds,
+            stats->seconds > 0 ? mb / stats->seconds : 0.0);
+}
@@ -0,0 +1,41 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdio.h>
+#include "command.h"
+
+/*
+ * Loads a trace of commands into a sink: a queue, a scheduler or an
+ * executor. The file is mapped in memory and split into segments of
+ * LOADER_SEGMENT_SIZE bytes, a line belonging to the segment its first
+ * char is in. Parser threads take segments in
+ * turn and parse them on their own; a parser then waits for the segments
+ * before its own to be added, so the sink gets the commands in the order
+ * of the file. The file is not changed.
+ *
+ * Standard input ("-"), pipes and sockets can't be mapped: they are read
+ * as a stream, by one thread, each command added as soon as its line is
+ * in, until the end of the stream.
+ *
+ * Loading stops at a 'q' line. A line that is not a valid command stops
+ * it too, once the commands before it are added.
+ */
+#define LOADER_SEGMENT_SIZE (64 * 1024)
+#define LOADER_DEFAULT_PARSERS 2
+
+/* returned by load_commands when a line is not a valid command */
+#define LOADER_INVALID -2
+
+
+typedef struct loaderStats {
+    unsigned long bytes;        /* size of the file */
+    unsigned long lines;        /* lines parsed */
+    unsigned long commands;     /* commands added to the sink */
+    double seconds;
+} LoaderStats;
+
+
+int load_commands(char *path, CommandSink put, void *sink, int parsers, LoaderStats *stats);
+void loader_print_stats(FILE *fp, LoaderStats *stats);
+
+#endif /* LOADER_H */
@@ -1,247 +1,387 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <getopt.h>
 #include <string.h>
 #include <ctype.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
 #include "fs/timer.h"
 #include "fs/operations.h"
+#include "fs/slab.h"
+#include "fs/epoch.h"
+#include "fs/lockprof.h"
+#include "fs/dcache.h"
+#include "command.h"
+#include "queue.h"
+#include "loader.h"
+#include "scheduler.h"
+#include "executor.h"
+#include "bench.h"
 #include "assert.h"
 
-#define MAX_COMMANDS 10
-#define MAX_INPUT_SIZE 100
-
-char inputCommands[MAX_COMMANDS][MAX_INPUT_SIZE];
-int numberCommands = 0;
-int headQueue = 0;
-
 char *inputFile = NULL;
 char *outputFile = NULL;
 int numberThreads = 0;
 char *synchStrategy = NULL;
 /* Produtor/Consumidor */
-pthread_mutex_t mutex;
-pthread_mutex_t doneMutex;
-pthread_cond_t notFull, notEmpty;
-int prodptr = 0;
-int consptr = 0;
-int done = 0;
-
-
-int insertCommand(char* data) {
-    if (numberCommands != MAX_COMMANDS) {
-        numberCommands++;
-        strcpy(inputCommands[prodptr], data);
-        prodptr ++; if (prodptr == MAX_COMMANDS) prodptr = 0;
-        return 1;
-    }
-    return 0;
-}
+CommandQueue commandQueue;
+int queueCapacity = QUEUE_DEFAULT_CAPACITY;
+/* comandos retirados de cada vez por uma consumidora */
+int batchSize = QUEUE_DEFAULT_BATCH;
+QueueStats *consumerStats = NULL;
+/* tarefas que fazem o parse do ficheiro de entrada */
+int numberParsers = LOADER_DEFAULT_PARSERS;
+LoaderStats loaderStats;
+/* Escalonador: comandos sem conflitos em paralelo, 0 para desligar */
+Scheduler scheduler;
+int schedWindow = SCHED_DEFAULT_WINDOW;
+/* Roubo de trabalho: cada consumidora com a sua fila, em vez do buffer */
+Executor executor;
+int workStealing = 0;
+ExecStats *workerStats = NULL;
+/* Relatorio periodico: segundos entre relatorios, 0 para nenhum */
+double reportInterval = 0;
+pthread_mutex_t reportMutex;
+pthread_cond_t reportStop;
+int finished = 0;
+/* Modo de benchmark: passagens medidas pelo ficheiro, 0 para desligar */
+int benchPasses = 0;
+int replays = 1;            /* passagens pelo ficheiro em cada execucao */
+int *threadCounts = NULL;   /* numeros de tarefas a medir */
+int numberThreadCounts = 0;
+int benchRecording = 0;
+BenchStats *benchStats = NULL;
 
-char * removeCommand() {
-    if (numberCommands > 0){
-        numberCommands--;
-        headQueue = consptr;
-        consptr ++; if (consptr == MAX_COMMANDS) consptr = 0;
-        return inputCommands[headQueue];
-    }
-    return NULL;
-}
 
 static void displayUsage (const char* appName){
-    printf("Usage: %s input_filepath output_filepath threads_number\n", appName);
+    printf("Usage: %s [-q queue_capacity] [-b batch_size] [-p parsers] [-r report_seconds] [-s window] [-w] [-k passes] input_filepath output_filepath threads_number\n"
+           "  -k: benchmark, prints JSON; threads_number may be a list, as 1,2,4\n", appName);
     exit(EXIT_FAILURE);
 }
 
 static void parseArgs (int argc, char* const argv[]){
+    int opt;
 
-    if (argc != 4){
+    while ((opt = getopt(argc, argv, "q:b:p:r:s:wk:")) != -1) {
+        switch (opt) {
+            case 'q':
+                queueCapacity = atoi(optarg);
+                if (queueCapacity <= 0) {
+                    fprintf(stderr, "Invalid queue capacity\n");
+                    displayUsage(argv[0]);
+                }
+                break;
+            case 'b':
+                batchSize = atoi(optarg);
+                if (batchSize <= 0) {
+                    fprintf(stderr, "Invalid batch size\n");
+                    displayUsage(argv[0]);
+                }
+                break;
+            case 'p':
+                numberParsers = atoi(optarg);
+                if (numberParsers <= 0) {
+                    fprintf(stderr, "Invalid number of parsers\n");
+                    displayUsage(argv[0]);
+                }
+                break;
+            case 'r':
+                reportInterval = atof(optarg);
+                if (reportInterval <= 0) {
+                    fprintf(stderr, "Invalid report interval\n");
+                    displayUsage(argv[0]);
+                }
+                break;
+            case 's':
+                schedWindow = atoi(optarg);
+                if (schedWindow < 0) {
+                    fprintf(stderr, "Invalid scheduler window\n");
+                    displayUsage(argv[0]);
+                }
+                break;
+            case 'w':
+                workStealing = 1;
+                break;
+            case 'k':
+                benchPasses = atoi(optarg);
+                if (benchPasses <= 0) {
+                    fprintf(stderr, "Invalid number of passes\n");
+                    displayUsage(argv[0]);
+                }
+                break;
+            default:
+                displayUsage(argv[0]);
+        }
+    }
+
+    if (argc - optind != 3){
         fprintf(stderr, "Invalid input:\n");
         displayUsage(argv[0]);
     }
-    inputFile = argv[1];
-    outputFile = argv[2];
-    numberThreads = atoi(argv[3]);
+    inputFile = argv[optind];
+    outputFile = argv[optind + 1];
+    /* o benchmark le o ficheiro varias vezes */
+    if (benchPasses > 0 && strcmp(inputFile, "-") == 0) {
+        fprintf(stderr, "Invalid input: the standard input can't be replayed\n");
+        displayUsage(argv[0]);
+    }
 
-    if (numberThreads <= 0) {
+    /* uma lista so no modo de benchmark */
+    threadCounts = malloc((strlen(argv[optind + 2]) / 2 + 1) * sizeof(int));
+    if (threadCounts == NULL) {
+        perror("Error: can't allocate thread counts.");
+        exit(EXIT_FAILURE);
+    }
+    for (char *count = strtok(argv[optind + 2], ","); count != NULL; count = strtok(NULL, ",")) {
+        threadCounts[numberThreadCounts] = atoi(count);
+        if (threadCounts[numberThreadCounts++] <= 0) {
+            numberThreadCounts = 0;
+            break;
+        }
+    }
+    if (numberThreadCounts == 0 || (numberThreadCounts > 1 && benchPasses == 0)) {
         fprintf(stderr, "Invalid number of threads\n");
         displayUsage(argv[0]);
     }
+    numberThreads = threadCounts[0];
 }
 
 
+/*
+ * Prints what a command does, except in the benchmark mode, so the
+ * latency measured is the file system's and not printf's.
+ */
+static void echo(const char *format, ...){
+    va_list args;
+
+    if (benchPasses > 0) {
+        return;
+    }
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
 void errorParse(){
     fprintf(stderr, "Error: command invalid\n");
     exit(EXIT_FAILURE);
 }
 
-void * processInput(){
-    FILE *file;
-    file = fopen(inputFile, "a");
-    /* q: condicao de paragem para as tarefas consumidoras */
-    fprintf(file, "q");
-    fclose(file);
-    file = fopen(inputFile, "r");
-
-     if (!file){
-        fprintf(stderr, "Error opening file %s\n", inputFile);
-        return NULL;
+static void enqueueCommands(void *queue, Command *commands, int n) {
+    for (int i = 0; i < n; i++) {
+        queue_enqueue((CommandQueue *) queue, &commands[i]);
     }
+}
 
-    char line[MAX_INPUT_SIZE];
-    while (fgets(line, sizeof(line)/sizeof(char), file)) {
-        char token, type;
-        char name[MAX_INPUT_SIZE];
+static void submitCommands(void *exec, Command *commands, int n) {
+    exec_submit((Executor *) exec, commands, n);
+}
 
-        int numTokens = sscanf(line, "%c %s %c", &token, name, &type);
-        
+static void scheduleCommands(void *sched, Command *commands, int n) {
+    sched_submit((Scheduler *) sched, commands, n);
+}
 
-        if (pthread_mutex_lock(&mutex) != 0){
-            perror("Error: Cannot lock mutex.");
+void * processInput(){
+    int res = SUCCESS;
+
+    /* comandos pela ordem do ficheiro, que nao e alterado; repetido no
+     * modo de benchmark */
+    for (int pass = 0; pass < replays && res == SUCCESS; pass++) {
+        if (schedWindow > 0) {
+            res = load_commands(inputFile, scheduleCommands, &scheduler, numberParsers, &loaderStats);
         }
-        /* Esperar enquanto buffer esta cheio */
-        
-        while (numberCommands == MAX_COMMANDS){
-            pthread_cond_wait(&notFull, &mutex);
+        else if (workStealing) {
+            res = load_commands(inputFile, submitCommands, &executor, numberParsers, &loaderStats);
         }
-        
-        /* perform minimal validation */
-        if (numTokens < 1) {
-            continue;
+        else {
+            res = load_commands(inputFile, enqueueCommands, &commandQueue, numberParsers, &loaderStats);
         }
-        switch (token) {
-            case 'c':
-                if (numTokens != 3){
-                    errorParse();
-                }
-                if (insertCommand(line))
-                    break;
-                return NULL;
-
-            case 'l':
-                if (numTokens != 2){
-                    errorParse();
-                }
-                if (insertCommand(line))
-                    break;
-                return NULL;
-
-            case 'd':
-                if (numTokens != 2)
-                    errorParse();
-                if (insertCommand(line))
-                    break;
-                return NULL;
-
-            case '#':
-                break;
-
-            case 'q':
-                if (numTokens != 1)
-                    errorParse();
-                if (insertCommand(line))
-                    break;
+    }
 
-            default: { /* error */
-                errorParse();
-            }
-        }
-        pthread_cond_signal(&notEmpty);
-        if (pthread_mutex_unlock(&mutex) != 0){
-            perror("Error: Cannot unlock mutex.");
-        }
+    if (res == FAIL) {
+        fprintf(stderr, "Error opening file %s\n", inputFile);
+    }
+    else if (res == LOADER_INVALID) {
+        errorParse();
+    }
+    /* consumidoras terminam quando o buffer fica vazio; com o
+     * escalonador, depois de sairem os comandos que esperam */
+    if (schedWindow > 0) {
+        sched_finish(&scheduler);
+    }
+    if (workStealing) {
+        exec_close(&executor);
+    }
+    else {
+        queue_close(&commandQueue);
     }
-    fclose(file);
-    pthread_mutex_lock(&doneMutex);
-    done = 1;
-    pthread_mutex_unlock(&doneMutex);
     return NULL;
 }
 
 
-void * applyCommands(){
-    while(1){
-
-        if (pthread_mutex_lock(&mutex) != 0){
-            perror("Error: Cannot lock mutex.");
+/* bytes of a file a read prints at most */
+#define READ_MAX_ECHO FILE_PAGE_SIZE
+
+/*
+ * Applies a command to the file system.
+ * Returns: SUCCESS, or FAIL if the command is unknown
+ */
+int applyCommand(Command *command){
+    char *name = command_path(command);
+    int searchResult;
+
+    switch (command->op) {
+        case 'c':
+            if (command->nodeType == T_FILE)
+                echo("Create file: %s\n", name);
+            else
+                echo("Create directory: %s\n", name);
+            create(name, command->nodeType);
+            break;
+
+        case 'l':
+            searchResult = lookup(name, READ, NULL);
+            if (searchResult >= 0)
+                echo("Search: %s found\n", name);
+            else
+                echo("Search: %s not found\n", name);
+            break;
+
+        case 'd':
+            echo("Delete: %s\n", name);
+            delete(name);
+            break;
+
+        case 'm':
+            echo("Move: %s to %s\n", name, command_target(command));
+            move(name, command_target(command));
+            break;
+
+        case 'w':
+            echo("Write: %s\n", name);
+            write_file(name, command_data(command), command->len, command->offset);
+            break;
+
+        case 'r': {
+            char buf[READ_MAX_ECHO];
+            int n = read_file(name, buf, command->len < READ_MAX_ECHO ? command->len : READ_MAX_ECHO,
+                              command->offset);
+            if (n >= 0)
+                echo("Read: %s: %.*s\n", name, n, buf);
+            else
+                echo("Read: %s failed\n", name);
+            break;
         }
-        //Esperar enquanto buffer vazio
-        while (numberCommands == 0){
-            if (pthread_mutex_lock(&doneMutex) != 0){
-                perror("Error: Cannot lock mutex.");
-            }
-            if (done == 1){
-                return NULL;
-            }
-            if (pthread_mutex_unlock(&doneMutex) != 0){
-                perror("Error: Cannot unlock mutex.");
-            }
-            pthread_cond_wait(&notEmpty, &mutex);
-        } 
 
-        const char* command = removeCommand();
-        if (command == NULL){
-            continue;
+        default: { /* error */
+            fprintf(stderr, "Error: command to apply\n");
+            return FAIL;
         }
+    }
+    return SUCCESS;
+}
 
-        char token, type;
-        char name[MAX_INPUT_SIZE];
-        int numTokens = sscanf(command, "%c %s %c", &token, name, &type);
 
-        if (numTokens < 2 && token != 'q') {
-            fprintf(stderr, "Error: invalid command in Queue\n");
-            return NULL;
-        }
+/*
+ * Takes the next commands for a consumer, up to batchSize, waiting while
+ * there are none.
+ * Returns: number of commands taken, 0 when there are no more
+ */
+static int takeCommands(long consumer, Command *batch){
+    if (workStealing) {
+        return exec_take(&executor, consumer, batch, batchSize, &workerStats[consumer]);
+    }
+    return queue_dequeue(&commandQueue, batch, batchSize, &consumerStats[consumer]);
+}
 
-        int searchResult;
-        switch (token) {
-            case 'c':
-                switch (type) {
-                    case 'f':
-                        printf("Create file: %s\n", name);
-                        create(name, T_FILE);
-                        break;
-                    case 'd':
-                        printf("Create directory: %s\n", name);
-                        create(name, T_DIRECTORY);
-                        break;
-                    default:
-                        fprintf(stderr, "Error: invalid node type\n");
-                        return NULL;
-                }
-                break;
+void * applyCommands(void *consumer){
+    Command *batch = malloc(batchSize * sizeof(Command));
+    int n, res = SUCCESS;
 
-            case 'l':
-                searchResult = lookup(name, READ, NULL);
-                if (searchResult >= 0)
-                    printf("Search: %s found\n", name);
-                else
-                    printf("Search: %s not found\n", name);
-                break;
+    if (batch == NULL) {
+        perror("Error: can't allocate batch.");
+        exit(EXIT_FAILURE);
+    }
+    /* Espera enquanto o buffer esta vazio; os comandos do lote sao
+     * aplicados sem tocar no buffer */
+    while (res == SUCCESS && (n = takeCommands((long) consumer, batch)) > 0) {
+        for (int i = 0; i < n && res == SUCCESS; i++) {
+            unsigned long start = benchRecording ? bench_now() : 0;
+            res = applyCommand(&batch[i]);
+            if (benchRecording) {
+                bench_record(&benchStats[(long) consumer], batch[i].op, bench_now() - start);
+            }
+        }
+        /* liberta os comandos que esperavam por estes */
+        if (schedWindow > 0) {
+            sched_complete(&scheduler, batch, n);
+        }
+    }
+    free(batch);
+    return NULL;
+}
 
-            case 'd':
-                printf("Delete: %s\n", name);
-                delete(name);
-                break;
+/*
+ * Reads how many commands went through the buffer, or through the inboxes
+ * of the executor, and how many they hold.
+ */
+static void countCommands(unsigned long *added, unsigned long *removed, unsigned long *capacity){
+    if (!workStealing) {
+        queue_counts(&commandQueue, added, removed);
+        *capacity = commandQueue.mask + 1;
+        return;
+    }
+    *added = *removed = *capacity = 0;
+    for (int i = 0; i < executor.workers; i++) {
+        unsigned long inboxAdded, inboxRemoved;
+        queue_counts(&executor.inboxes[i], &inboxAdded, &inboxRemoved);
+        *added += inboxAdded;
+        *removed += inboxRemoved;
+        *capacity += executor.inboxes[i].mask + 1;
+    }
+}
 
-            case 'q':
-                insertCommand((char *)command);
-                pthread_mutex_unlock(&mutex);
-                return NULL;
+/*
+ * Prints, every reportInterval seconds until the consumers finish, the
+ * commands taken from the buffer since the last report and how many are
+ * waiting in it.
+ */
+void * reportProgress(){
+    TIMER_T start, last, now;
+    struct timespec deadline;
+    unsigned long added, removed, capacity, lastRemoved = 0;
 
-            default: { /* error */
-                fprintf(stderr, "Error: command to apply\n");
-                return NULL;
-            }
+    TIMER_READ(start);
+    last = start;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    pthread_mutex_lock(&reportMutex);
+    while (!finished) {
+        long ns = deadline.tv_nsec + (long) ((reportInterval - (long) reportInterval) * 1e9);
+        deadline.tv_sec += (long) reportInterval + ns / 1000000000;
+        deadline.tv_nsec = ns % 1000000000;
+        /* acordada mais cedo so quando as consumidoras terminam */
+        while (!finished &&
+               pthread_cond_timedwait(&reportStop, &reportMutex, &deadline) != ETIMEDOUT) {
         }
-        pthread_cond_signal(&notFull);
-        if (pthread_mutex_unlock(&mutex) != 0){
-            perror("Error: Cannot unlock mutex.");
+        if (finished) {
+            break;
         }
+        TIMER_READ(now);
+        countCommands(&added, &removed, &capacity);
+        fprintf(stderr, "progress: %.1f s, %lu commands taken (%.0f/s), %lu queued of %lu\n",
+                TIMER_DIFF_SECONDS(start, now), removed,
+                (removed - lastRemoved) / TIMER_DIFF_SECONDS(last, now),
+                added - removed, capacity);
+        last = now;
+        lastRemoved = removed;
     }
+    pthread_mutex_unlock(&reportMutex);
+    return NULL;
 }
 
 FILE * openOutputFile(){
@@ -260,13 +400,24 @@ void poolThreads(FILE * timeFile){
 
     pthread_t *threads = (pthread_t*) malloc ((numberThreads + 1) * sizeof(pthread_t));
 
+    pthread_t reporter;
+    if (reportInterval > 0) {
+        pthread_mutex_init(&reportMutex, NULL);
+        pthread_cond_init(&reportStop, NULL);
+        if (pthread_create(&reporter, NULL, reportProgress, NULL) != 0) {
+            perror("Error: can't create thread.");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    finished = 0;
     TIMER_READ(start);
     int err;
     for (int i = 0; i < numberThreads + 1; i++){
         if (i == 0)
             err = pthread_create(&threads[i], NULL, processInput, NULL);
         else{
-            err = pthread_create(&threads[i], NULL, applyCommands, NULL);    
+            err = pthread_create(&threads[i], NULL, applyCommands, (void *) (long) (i - 1));
         }
         if (err != 0) {
             perror("Error: can't create thread.");
@@ -274,35 +425,167 @@ void poolThreads(FILE * timeFile){
         }
     }
 
-    for (int i = 0; i < numberThreads; i++) {
+    for (int i = 0; i < numberThreads + 1; i++) {
         if (pthread_join(threads[i], NULL)) {
             perror("Error: can't join thread.");
         }
     }
 
     TIMER_READ(stop);
-    fprintf(timeFile,"TecnicoFS completed in %.4f seconds.\n", TIMER_DIFF_SECONDS(start, stop));
+    if (reportInterval > 0) {
+        pthread_mutex_lock(&reportMutex);
+        finished = 1;
+        pthread_cond_signal(&reportStop);
+        pthread_mutex_unlock(&reportMutex);
+        if (pthread_join(reporter, NULL)) {
+            perror("Error: can't join thread.");
+        }
+        pthread_mutex_destroy(&reportMutex);
+        pthread_cond_destroy(&reportStop);
+    }
+    if (timeFile != NULL) {
+        fprintf(timeFile,"TecnicoFS completed in %.4f seconds.\n", TIMER_DIFF_SECONDS(start, stop));
+    }
     free(threads);
 }
 
+/*
+ * Creates the buffer, and the executor and scheduler in use, for
+ * numberThreads consumers.
+ */
+static void initPipeline(){
+    consumerStats = calloc(numberThreads, sizeof(QueueStats));
+    if (!queue_init(&commandQueue, queueCapacity) || consumerStats == NULL) {
+        fprintf(stderr, "Error: can't create command queue\n");
+        exit(EXIT_FAILURE);
+    }
+    workerStats = calloc(numberThreads, sizeof(ExecStats));
+    if (workStealing && (workerStats == NULL ||
+                         exec_init(&executor, numberThreads, queueCapacity) == FAIL)) {
+        fprintf(stderr, "Error: can't create executor\n");
+        exit(EXIT_FAILURE);
+    }
+    if (schedWindow > 0 &&
+        sched_init(&scheduler, workStealing ? submitCommands : enqueueCommands,
+                   workStealing ? (void *) &executor : (void *) &commandQueue,
+                   schedWindow) == FAIL) {
+        fprintf(stderr, "Error: can't create scheduler\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void destroyPipeline(){
+    /* counters of the run, for tuning */
+    if (getenv("TECNICOFS_STATS")) {
+        if (workStealing) {
+            exec_print_stats(stderr, workerStats, numberThreads);
+        }
+        else {
+            queue_print_stats(stderr, consumerStats, numberThreads);
+        }
+        if (schedWindow > 0) {
+            sched_print_stats(stderr, &scheduler);
+        }
+    }
+    if (schedWindow > 0) {
+        sched_destroy(&scheduler);
+    }
+    if (workStealing) {
+        exec_destroy(&executor);
+    }
+    queue_destroy(&commandQueue);
+    free(consumerStats);
+    free(workerStats);
+}
+
+/*
+ * Replays the input over a warm file system: a first pass, not measured,
+ * fills the namespace, then benchPasses passes are run for each number
+ * of threads. Prints the runs to stdout as JSON, with the latency of
+ * each command from the monotonic clock.
+ */
+static void runBenchmark(){
+    /* o sistema de ficheiros escreve as falhas no stdout: os resultados
+     * vao para o stdout original, o resto para /dev/null */
+    fflush(stdout);
+    int resultsFd = dup(STDOUT_FILENO);
+    FILE *results = resultsFd >= 0 ? fdopen(resultsFd, "w") : NULL;
+    if (results == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        perror("Error: can't redirect stdout.");
+        exit(EXIT_FAILURE);
+    }
+
+    numberThreads = threadCounts[0];
+    initPipeline();
+    poolThreads(NULL);
+    destroyPipeline();
+
+    fprintf(results, "{\"input\": ");
+    bench_print_string(results, inputFile);
+    fprintf(results, ", \"passes\": %d, \"window\": %d, \"work_stealing\": %s, "
+           "\"batch\": %d, \"queue\": %d, \"parsers\": %d, \"runs\": [\n",
+           benchPasses, schedWindow, workStealing ? "true" : "false",
+           batchSize, queueCapacity, numberParsers);
+    replays = benchPasses;
+    benchRecording = 1;
+    for (int i = 0; i < numberThreadCounts; i++) {
+        numberThreads = threadCounts[i];
+        benchStats = calloc(numberThreads, sizeof(BenchStats));
+        if (benchStats == NULL) {
+            perror("Error: can't allocate samples.");
+            exit(EXIT_FAILURE);
+        }
+        initPipeline();
+        unsigned long start = bench_now();
+        poolThreads(NULL);
+        double seconds = (bench_now() - start) / 1e9;
+        destroyPipeline();
+
+        bench_print_run(results, benchStats, numberThreads, seconds);
+        fprintf(results, i < numberThreadCounts - 1 ? ",\n" : "\n");
+        bench_free(benchStats, numberThreads);
+        free(benchStats);
+    }
+    fprintf(results, "]}\n");
+    fclose(results);
+}
+
 int main(int argc, char* argv[]) {
 
     /* init filesystem */
     init_fs();
     parseArgs(argc, argv);
-    pthread_mutex_init(&mutex, NULL);
-    pthread_mutex_init(&doneMutex, NULL);
+    /* o escalonador nunca espera pelo buffer: cabe la a janela toda */
+    if (schedWindow > queueCapacity) {
+        queueCapacity = schedWindow;
+    }
     FILE * output_file = openOutputFile();
 
 
     /* creates thread pool */
-    poolThreads(stdout);
+    if (benchPasses > 0) {
+        runBenchmark();
+    }
+    else {
+        initPipeline();
+        poolThreads(stdout);
+        destroyPipeline();
+    }
     print_tecnicofs_tree(output_file);
     fflush(output_file);
     fclose(output_file);
 
-    pthread_mutex_destroy(&mutex);
-    pthread_mutex_destroy(&doneMutex);
+    /* allocator and cache counters, for tuning */
+    if (getenv("TECNICOFS_STATS")) {
+        slab_print_stats(stderr);
+        epoch_print_stats(stderr);
+        dcache_print_stats(stderr);
+        loader_print_stats(stderr, &loaderStats);
+    }
+    /* lock contention, if TECNICOFS_LOCKPROF is set */
+    lockprof_report(stderr);
+
+    free(threadCounts);
     /* release allocated memory */
     destroy_fs();
     exit(EXIT_SUCCESS);
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "queue.h"
+
+
+static void queue_futex_wait(unsigned int *event, unsigned int expected) {
+    syscall(SYS_futex, event, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void queue_futex_wake(unsigned int *event, int n) {
+    syscall(SYS_futex, event, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+/*
+ * Wakes up to n threads waiting on an event, skipping the waiters that
+ * were already signalled: a woken thread may take a while to run, and
+ * until then there is no one else to wake. Must be called after the
+ * change the waiters wait for is published.
+ * Returns: number of threads signalled
+ */
+int queue_event_signal(unsigned int *event, unsigned int n) {
+    /* the change must be visible before the waiters are read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned int state = __atomic_load_n(event, __ATOMIC_SEQ_CST);
+    unsigned int unsignalled;
+
+    while ((unsignalled = QUEUE_WAITERS(state) - QUEUE_SIGNALS(state)) > 0) {
+        if (unsignalled > n) {
+            unsignalled = n;
+        }
+        if (__atomic_compare_exchange_n(event, &state, state + unsignalled * QUEUE_SIGNAL, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            queue_futex_wake(event, unsignalled);
+            return unsignalled;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Waits on an event until it changes from state, unless a signal is
+ * pending, which is taken instead. The caller must be a waiter.
+ */
+void queue_event_wait(unsigned int *event) {
+    unsigned int state = __atomic_load_n(event, __ATOMIC_SEQ_CST);
+
+    if (QUEUE_SIGNALS(state) > 0) {
+        __atomic_compare_exchange_n(event, &state, state - QUEUE_SIGNAL, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        return;
+    }
+    queue_futex_wait(event, state);
+}
+
+/*
+ * Stops waiting on an event. A pending signal is taken along, as it may
+ * have woken the caller.
+ */
+void queue_event_leave(unsigned int *event) {
+    unsigned int state = __atomic_load_n(event, __ATOMIC_SEQ_CST);
+    unsigned int next;
+
+    do {
+        next = state - QUEUE_WAITER;
+        if (QUEUE_SIGNALS(state) > 0) {
+            next -= QUEUE_SIGNAL;
+        }
+    } while (!__atomic_compare_exchange_n(event, &state, next, 0,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+}
+
+
+/*
+ * Initializes an empty queue.
+ * Input:
+ *  - queue: the queue
+ *  - capacity: number of commands it holds, rounded up to a power of two
+ *    and at least 2 (with a single cell, a full cell and the free cell of
+ *    the next lap have the same sequence number)
+ * Returns: 1 if initialized, 0 if out of memory or capacity is not positive
+ */
+int queue_init(CommandQueue *queue, int capacity) {
+    unsigned long size = 2;
+
+    if (capacity <= 0) {
+        return 0;
+    }
+    while (size < (unsigned long) capacity) {
+        size <<= 1;
+    }
+    if (posix_memalign((void **) &queue->cells, 64, size * sizeof(QueueCell)) != 0) {
+        return 0;
+    }
+    for (unsigned long i = 0; i < size; i++) {
+        queue->cells[i].sequence = i;
+    }
+    queue->mask = size - 1;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->notEmpty = 0;
+    queue->notFull = 0;
+    queue->closed = 0;
+    return 1;
+}
+
+void queue_destroy(CommandQueue *queue) {
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+/*
+ * Adds a command, if there is room.
+ * Returns: 1 if added, 0 if the queue is full
+ */
+int queue_try_enqueue(CommandQueue *queue, const Command *command) {
+    unsigned long pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        QueueCell *cell = &queue->cells[pos & queue->mask];
+        unsigned long sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long) (sequence - pos);
+
+        if (diff == 0) {
+            /* the cell is free for this lap, claim it */
+            if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->command = *command;
+                __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        }
+        else if (diff < 0) {
+            /* still holds the command of the previous lap */
+            return 0;
+        }
+        else {
+            pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+ * Removes the oldest commands, as many as are ready up to max, claiming
+ * them all with a single update of the head. Producers are not signalled.
+ * Input:
+ *  - commands: array of max commands to store them
+ *  - stats: counters of the caller, or NULL
+ * Returns: number of commands removed, 0 if the queue is empty
+ */
+static int queue_claim(CommandQueue *queue, Command *commands, int max, QueueStats *stats) {
+    unsigned long pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        int n = 0;
+
+        /* a full lap is never ready: the cell after it is the first one */
+        while (n < max) {
+            QueueCell *cell = &queue->cells[(pos + n) & queue->mask];
+            if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != pos + n + 1) {
+                break;
+            }
+            n++;
+        }
+        if (n == 0) {
+            QueueCell *cell = &queue->cells[pos & queue->mask];
+            long diff = (long) (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (pos + 1));
+            if (diff < 0) {
+                return 0;
+            }
+            /* taken by another consumer */
+            pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&queue->head, &pos, pos + n, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            for (int i = 0; i < n; i++) {
+                QueueCell *cell = &queue->cells[(pos + i) & queue->mask];
+                commands[i] = cell->command;
+                /* free for the writer of the next lap */
+                __atomic_store_n(&cell->sequence, pos + i + queue->mask + 1, __ATOMIC_RELEASE);
+            }
+            return n;
+        }
+        if (stats != NULL) {
+            stats->retries++;
+        }
+    }
+}
+
+/*
+ * Signals the producers waiting for the room n commands removed left,
+ * once for the whole batch, and counts the batch.
+ */
+static void queue_removed(CommandQueue *queue, int n, QueueStats *stats) {
+    int woken = queue_event_signal(&queue->notFull, n);
+
+    if (stats != NULL) {
+        int bucket = 0;
+        while (bucket < QUEUE_STATS_BUCKETS - 1 && (2 << bucket) <= n) {
+            bucket++;
+        }
+        stats->batches++;
+        stats->commands += n;
+        stats->wakes += woken;
+        stats->sizes[bucket]++;
+    }
+}
+
+/*
+ * Removes the oldest commands, up to max, without waiting.
+ * Input:
+ *  - commands: array of max commands to store them
+ *  - stats: counters of the caller, or NULL
+ * Returns: number of commands removed, 0 if the queue is empty
+ */
+int queue_try_dequeue(CommandQueue *queue, Command *commands, int max, QueueStats *stats) {
+    int n = queue_claim(queue, commands, max, stats);
+
+    if (n > 0) {
+        queue_removed(queue, n, stats);
+    }
+    return n;
+}
+
+/*
+ * Adds a command, waiting while the queue is full.
+ */
+void queue_enqueue(CommandQueue *queue, const Command *command) {
+    if (!queue_try_enqueue(queue, command)) {
+        __atomic_add_fetch(&queue->notFull, QUEUE_WAITER, __ATOMIC_SEQ_CST);
+        /* a consumer that freed a cell before the waiter was counted did
+         * not signal, try again before every wait */
+        while (!queue_try_enqueue(queue, command)) {
+            queue_event_wait(&queue->notFull);
+        }
+        queue_event_leave(&queue->notFull);
+    }
+    queue_event_signal(&queue->notEmpty, 1);
+}
+
+/*
+ * Removes the oldest commands, up to max, waiting while the queue is
+ * empty and open. Producers waiting for room are signalled once for the
+ * whole batch.
+ * Input:
+ *  - commands: array of max commands to store them
+ *  - stats: counters of the caller, or NULL
+ * Returns: number of commands removed, 0 if the queue is closed and empty
+ */
+int queue_dequeue(CommandQueue *queue, Command *commands, int max, QueueStats *stats) {
+    int n = queue_claim(queue, commands, max, stats);
+
+    if (n == 0) {
+        __atomic_add_fetch(&queue->notEmpty, QUEUE_WAITER, __ATOMIC_SEQ_CST);
+        while ((n = queue_claim(queue, commands, max, stats)) == 0 &&
+               !__atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST)) {
+            queue_event_wait(&queue->notEmpty);
+            if (stats != NULL) {
+                stats->waits++;
+            }
+        }
+        queue_event_leave(&queue->notEmpty);
+        /* commands added before the close are still taken */
+        if (n == 0 && (n = queue_claim(queue, commands, max, stats)) == 0) {
+            return 0;
+        }
+    }
+    queue_removed(queue, n, stats);
+    return n;
+}
+
+/*
+ * Marks the end of the commands: consumers return once the queue is
+ * empty. Must be called after the last command is added.
+ */
+void queue_close(CommandQueue *queue) {
+    unsigned int state = __atomic_load_n(&queue->notEmpty, __ATOMIC_SEQ_CST);
+
+    __atomic_store_n(&queue->closed, 1, __ATOMIC_SEQ_CST);
+    /* signal every waiter, those not asleep yet see it before waiting */
+    while (!__atomic_compare_exchange_n(&queue->notEmpty, &state,
+                                        QUEUE_WAITERS(state) * (QUEUE_SIGNAL + QUEUE_WAITER), 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    }
+    queue_futex_wake(&queue->notEmpty, INT_MAX);
+}
+
+/*
+ * Reads how many commands went through a queue, without stopping it.
+ * Input:
+ *  - added: reference to store the commands added so far
+ *  - removed: reference to store the commands removed so far
+ */
+void queue_counts(CommandQueue *queue, unsigned long *added, unsigned long *removed) {
+    *removed = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    *added = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    /* the head may pass a tail read before it */
+    if (*added < *removed) {
+        *added = *removed;
+    }
+}
+
+/*
+ * Prints the counters of the consumers of a queue, merged.
+ * Input:
+ *  - fp: file to print to
+ *  - stats: array of n counters
+ */
+void queue_print_stats(FILE *fp, QueueStats *stats, int n) {
+    QueueStats total;
+
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < n; i++) {
+        total.batches += stats[i].batches;
+        total.commands += stats[i].commands;
+        total.retries += stats[i].retries;
+        total.waits += stats[i].waits;
+        total.wakes += stats[i].wakes;
+        for (int b = 0; b < QUEUE_STATS_BUCKETS; b++) {
+            total.sizes[b] += stats[i].sizes[b];
+        }
+    }
+    double per_command = total.commands > 0 ? 1.0 / total.commands : 0.0;
+    fprintf(fp, "queue: %lu commands in %lu batches (%.1f per batch), per command "
+            "%.3f head claims, %.3f retries, %.3f waits, %.3f wakes\n",
+            total.commands, total.batches,
+            total.batches > 0 ? (double) total.commands / total.batches : 0.0,
+            total.batches * per_command, total.retries * per_command,
+            total.waits * per_command, total.wakes * per_command);
+    fprintf(fp, "queue: batch sizes");
+    for (int b = 0; b < QUEUE_STATS_BUCKETS; b++) {
+        if (total.sizes[b] > 0) {
+            fprintf(fp, " %d+:%lu", 1 << b, total.sizes[b]);
+        }
+    }
+    fprintf(fp, "\n");
+}
@@ -0,0 +1,79 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdio.h>
+#include "command.h"
+
+/*
+ * Bounded multi-producer multi-consumer queue of commands, lock-free
+ * (Vyukov's array queue). Every cell holds one parsed command and a
+ * sequence number telling whether the cell is ready to be written or read
+ * for the current lap around the ring. Producers and consumers only
+ * contend on the tail and head indices.
+ *
+ * Threads that find the queue full or empty park on a futex word that
+ * counts the threads waiting on it and the signals sent to them. A thread
+ * that adds or removes a command only makes a system call when some
+ * waiter has not been signalled yet, so a queue that never runs dry costs
+ * none. Closing the queue wakes every consumer once the remaining
+ * commands are drained.
+ *
+ * Consumers take commands in batches: the cells ready after the head are
+ * claimed together with one update of the head, and the producers they
+ * make room for are signalled once per batch.
+ */
+#define QUEUE_DEFAULT_CAPACITY 64
+#define QUEUE_DEFAULT_BATCH 8
+
+/* batch sizes are counted in powers of two */
+#define QUEUE_STATS_BUCKETS 8
+
+/* futex words: waiters in the low half, pending signals in the high half */
+#define QUEUE_WAITER 1u
+#define QUEUE_SIGNAL (1u << 16)
+#define QUEUE_WAITERS(event) ((event) & 0xffffu)
+#define QUEUE_SIGNALS(event) ((event) >> 16)
+
+
+typedef struct queueCell {
+    unsigned long sequence;
+    Command command;
+} __attribute__((aligned(64))) QueueCell;
+
+typedef struct commandQueue {
+    unsigned long head __attribute__((aligned(64)));    /* next cell to read */
+    unsigned long tail __attribute__((aligned(64)));    /* next cell to write */
+    unsigned int notEmpty __attribute__((aligned(64)));
+    unsigned int notFull;
+    int closed;
+    unsigned long mask;     /* capacity - 1, the capacity is a power of two */
+    QueueCell *cells;
+} CommandQueue;
+
+/* counters of a consumer, only written by its own thread */
+typedef struct queueStats {
+    unsigned long batches;      /* dequeues that got commands */
+    unsigned long commands;
+    unsigned long retries;      /* claims of the head lost to another consumer */
+    unsigned long waits;        /* times parked on an empty queue */
+    unsigned long wakes;        /* producers signalled */
+    unsigned long sizes[QUEUE_STATS_BUCKETS];   /* batches of 2^i commands or more */
+} QueueStats;
+
+
+int queue_init(CommandQueue *queue, int capacity);
+void queue_destroy(CommandQueue *queue);
+int queue_try_enqueue(CommandQueue *queue, const Command *command);
+int queue_try_dequeue(CommandQueue *queue, Command *commands, int max, QueueStats *stats);
+void queue_enqueue(CommandQueue *queue, const Command *command);
+int queue_dequeue(CommandQueue *queue, Command *commands, int max, QueueStats *stats);
+void queue_close(CommandQueue *queue);
+void queue_counts(CommandQueue *queue, unsigned long *added, unsigned long *removed);
+void queue_print_stats(FILE *fp, QueueStats *stats, int n);
+
+/* waiting on a futex word, as the queue does; for other events */
+int queue_event_signal(unsigned int *event, unsigned int n);
+void queue_event_wait(unsigned int *event);
+void queue_event_leave(unsigned int *event);
+
+#endif /* QUEUE_H */
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "scheduler.h"
+#include "fs/path.h"
+#include "fs/state.h"
+
+
+static SchedSlot *sched_slot(Scheduler *sched, unsigned long ticket) {
+    return &sched->slots[ticket % sched->window];
+}
+
+/*
+ * Returns: 1 if the command with a ticket was submitted and has not
+ *  completed, 0 otherwise
+ */
+static int sched_live(Scheduler *sched, unsigned long ticket) {
+    SchedSlot *slot = sched_slot(sched, ticket);
+
+    return ticket != 0 && slot->ticket == ticket && !slot->done;
+}
+
+/*
+ * Appends a ticket to a growing array of tickets.
+ */
+static void sched_append(unsigned long **tickets, int *n, int *capacity, unsigned long ticket) {
+    if (*n == *capacity) {
+        *capacity = *capacity > 0 ? 2 * *capacity : 8;
+        *tickets = realloc(*tickets, *capacity * sizeof(unsigned long));
+        if (*tickets == NULL) {
+            perror("Error: can't allocate scheduler.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*tickets)[(*n)++] = ticket;
+}
+
+/*
+ * Makes a command wait for another. Must be called with the lock held.
+ */
+static void sched_add_edge(Scheduler *sched, unsigned long from, unsigned long to) {
+    SchedSlot *slot = sched_slot(sched, from);
+
+    /* the edges of a command are added together, a repeated one is last */
+    if (slot->nsuccessors > 0 && slot->successors[slot->nsuccessors - 1] == to) {
+        return;
+    }
+    sched_append(&slot->successors, &slot->nsuccessors, &slot->capacity, to);
+    sched_slot(sched, to)->deps++;
+    sched->edges++;
+}
+
+/*
+ * Drops the tickets of finished commands from an entry.
+ * Returns: 1 if no unfinished command touches the entry anymore
+ */
+static int sched_entry_prune(Scheduler *sched, SchedEntry *entry) {
+    int n = 0;
+
+    for (int i = 0; i < entry->naccessors; i++) {
+        if (sched_live(sched, entry->accessors[i])) {
+            entry->accessors[n++] = entry->accessors[i];
+        }
+    }
+    entry->naccessors = n;
+    return n == 0 && !sched_live(sched, entry->writer);
+}
+
+/*
+ * Finds the entry of a path, creating it if needed, and frees the entries
+ * of its bucket no unfinished command touches. Must be called with the
+ * lock held.
+ */
+static SchedEntry *sched_entry(Scheduler *sched, unsigned int hash) {
+    SchedEntry **link = &sched->buckets[hash % SCHED_BUCKETS];
+    SchedEntry *found = NULL;
+
+    while (*link != NULL) {
+        SchedEntry *entry = *link;
+        if (entry->hash == hash) {
+            found = entry;
+        }
+        else if (sched_entry_prune(sched, entry)) {
+            *link = entry->next;
+            free(entry->accessors);
+            free(entry);
+            continue;
+        }
+        link = &entry->next;
+    }
+    if (found == NULL) {
+        found = calloc(1, sizeof(SchedEntry));
+        if (found == NULL) {
+            perror("Error: can't allocate scheduler.");
+            exit(EXIT_FAILURE);
+        }
+        found->hash = hash;
+        found->next = sched->buckets[hash % SCHED_BUCKETS];
+        sched->buckets[hash % SCHED_BUCKETS] = found;
+    }
+    return found;
+}
+
+/*
+ * Records the accesses of a command to a path, adding the edges from the
+ * commands it has to wait for. Must be called with the lock held.
+ * Input:
+ *  - sched: the scheduler
+ *  - ticket: ticket of the command
+ *  - name: the path
+ *  - write: 1 if the command writes the node of the path
+ */
+static void sched_access(Scheduler *sched, unsigned long ticket, char *name, int write) {
+    unsigned int hash = PATH_HASH_INIT;
+    SchedEntry *entry = NULL;
+    int depth = 0;
+    int in_component = 0;
+
+    /* every prefix, hashed in canonical form as path_parse does */
+    for (char *c = name; ; c++) {
+        if (*c != '/' && *c != '\0') {
+            if (!in_component) {
+                if (depth > 0) {
+                    hash = PATH_HASH_STEP(hash, '/');
+                }
+                depth++;
+                in_component = 1;
+            }
+            hash = PATH_HASH_STEP(hash, *c);
+            continue;
+        }
+        if (in_component) {
+            entry = sched_entry(sched, hash);
+            if (sched_live(sched, entry->writer) && entry->writer != ticket) {
+                sched_add_edge(sched, entry->writer, ticket);
+            }
+            if (entry->naccessors == entry->capacity) {
+                sched_entry_prune(sched, entry);
+            }
+            if (entry->naccessors == 0 || entry->accessors[entry->naccessors - 1] != ticket) {
+                sched_append(&entry->accessors, &entry->naccessors, &entry->capacity, ticket);
+            }
+            in_component = 0;
+        }
+        if (*c == '\0') {
+            break;
+        }
+    }
+
+    /* entry is the node, the root is never written */
+    if (write && entry != NULL) {
+        for (int i = 0; i < entry->naccessors; i++) {
+            unsigned long accessor = entry->accessors[i];
+            if (accessor != ticket && sched_live(sched, accessor)) {
+                sched_add_edge(sched, accessor, ticket);
+            }
+        }
+        /* later accesses wait for this one, which waits for those */
+        entry->writer = ticket;
+        entry->naccessors = 0;
+    }
+}
+
+
+/*
+ * Initializes a scheduler.
+ * Input:
+ *  - sched: the scheduler
+ *  - put, sink: where the commands ready to run go
+ *  - window: most commands submitted and not completed at a time
+ * Returns: SUCCESS or FAIL
+ */
+int sched_init(Scheduler *sched, CommandSink put, void *sink, int window) {
+    memset(sched, 0, sizeof(Scheduler));
+    if (window <= 0) {
+        return FAIL;
+    }
+    sched->slots = calloc(window, sizeof(SchedSlot));
+    if (sched->slots == NULL) {
+        return FAIL;
+    }
+    sched->put = put;
+    sched->sink = sink;
+    sched->window = window;
+    sched->nextTicket = 1;
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_cond_init(&sched->slotFreed, NULL);
+    return SUCCESS;
+}
+
+void sched_destroy(Scheduler *sched) {
+    for (int b = 0; b < SCHED_BUCKETS; b++) {
+        SchedEntry *entry = sched->buckets[b];
+        while (entry != NULL) {
+            SchedEntry *next = entry->next;
+            free(entry->accessors);
+            free(entry);
+            entry = next;
+        }
+    }
+    for (unsigned long i = 0; i < sched->window; i++) {
+        free(sched->slots[i].successors);
+    }
+    free(sched->slots);
+    pthread_mutex_destroy(&sched->lock);
+    pthread_cond_destroy(&sched->slotFreed);
+}
+
+/*
+ * Records one command of the trace, sending it to the sink if it
+ * conflicts with no unfinished command before it. Waits while window
+ * commands are unfinished. Must be called with the lock held.
+ */
+static void sched_add(Scheduler *sched, Command *command) {
+    unsigned long ticket = sched->nextTicket++;
+    SchedSlot *slot = sched_slot(sched, ticket);
+
+    while (slot->ticket != 0 && !slot->done) {
+        pthread_cond_wait(&sched->slotFreed, &sched->lock);
+    }
+    slot->ticket = ticket;
+    slot->done = 0;
+    slot->deps = 0;
+    slot->nsuccessors = 0;
+    slot->command = *command;
+    slot->command.ticket = ticket;
+
+    char *name = command_path(&slot->command);
+    switch (command->op) {
+        case 'c':
+        case 'd':
+        case 'w':
+            sched_access(sched, ticket, name, 1);
+            break;
+        case 'm':
+            sched_access(sched, ticket, name, 1);
+            sched_access(sched, ticket, command_target(&slot->command), 1);
+            break;
+        default:
+            sched_access(sched, ticket, name, 0);
+    }
+
+    sched->submitted++;
+    if (slot->deps == 0) {
+        sched->put(sched->sink, &slot->command, 1);
+    }
+    else {
+        sched->deferred++;
+        if (++sched->pending > sched->maxPending) {
+            sched->maxPending = sched->pending;
+        }
+    }
+}
+
+/*
+ * Submits the next commands of the trace: each goes to the sink now if
+ * it conflicts with no unfinished command before it, or when they
+ * complete. The lock is taken once for all of them.
+ * Input:
+ *  - sched: the scheduler
+ *  - commands: array of n commands, in trace order
+ */
+void sched_submit(Scheduler *sched, Command *commands, int n) {
+    pthread_mutex_lock(&sched->lock);
+    for (int i = 0; i < n; i++) {
+        sched_add(sched, &commands[i]);
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+/*
+ * Marks commands as completed, sending the commands that were only
+ * waiting for them to the sink.
+ * Input:
+ *  - sched: the scheduler
+ *  - commands: array of n commands it was sent
+ */
+void sched_complete(Scheduler *sched, Command *commands, int n) {
+    pthread_mutex_lock(&sched->lock);
+    for (int i = 0; i < n; i++) {
+        SchedSlot *slot = sched_slot(sched, commands[i].ticket);
+
+        slot->done = 1;
+        for (int s = 0; s < slot->nsuccessors; s++) {
+            SchedSlot *successor = sched_slot(sched, slot->successors[s]);
+            if (--successor->deps == 0) {
+                sched->put(sched->sink, &successor->command, 1);
+                sched->pending--;
+            }
+        }
+    }
+    pthread_cond_signal(&sched->slotFreed);
+    pthread_mutex_unlock(&sched->lock);
+}
+
+/*
+ * Waits until every command submitted has been sent to the sink, so it
+ * can be closed. Must be called by the thread that submits.
+ */
+void sched_finish(Scheduler *sched) {
+    pthread_mutex_lock(&sched->lock);
+    while (sched->pending > 0) {
+        pthread_cond_wait(&sched->slotFreed, &sched->lock);
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+void sched_print_stats(FILE *fp, Scheduler *sched) {
+    fprintf(fp, "scheduler: %lu commands, %lu waited (%.1f%%), %lu dependencies, "
+            "at most %lu waiting, window %lu\n",
+            sched->submitted, sched->deferred,
+            sched->submitted > 0 ? 100.0 * sched->deferred / sched->submitted : 0.0,
+            sched->edges, sched->maxPending, sched->window);
+}
@@ -0,0 +1,80 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "command.h"
+
+/*
+ * Orders the commands of a trace by the paths they touch: commands that
+ * do not conflict run in parallel, commands that do run in trace order,
+ * so the results are those of running the trace sequentially.
+ *
+ * A command reads every prefix of its paths and writes the nodes it
+ * creates, deletes, moves or writes to. Writing a path conflicts with any access to
+ * it or below it: creating /a/b conflicts with looking up /a/b/c and with
+ * deleting /a, not with creating /a/c. Paths are compared by their hash,
+ * so a collision only adds an order that was not needed.
+ *
+ * Every command gets a ticket, in trace order. For each path the
+ * scheduler keeps its last writer and the commands that accessed it, or
+ * a path below it, since; a new command waits for the last writer of
+ * each of its prefixes and, for the paths it writes, for those
+ * accessors. A command with nothing to wait for goes to the sink at
+ * once, ahead of the blocked ones before it; the others go when the last
+ * command they wait for completes.
+ *
+ * At most window commands are unfinished at a time, submitting more
+ * waits. Ready commands go to a sink, which must take window commands
+ * without waiting, as it is called with the scheduler locked.
+ */
+#define SCHED_DEFAULT_WINDOW 256
+#define SCHED_BUCKETS 4096
+
+
+/* a path, by hash, and the unfinished commands that touched it */
+typedef struct schedEntry {
+    unsigned int hash;
+    unsigned long writer;           /* ticket of the last writer, 0 if none */
+    unsigned long *accessors;       /* tickets of the accesses since */
+    int naccessors;
+    int capacity;
+    struct schedEntry *next;
+} SchedEntry;
+
+typedef struct schedSlot {
+    unsigned long ticket;           /* 0 if never used */
+    int done;
+    int deps;                       /* unfinished commands it waits for */
+    unsigned long *successors;      /* tickets of the commands waiting for it */
+    int nsuccessors;
+    int capacity;
+    Command command;
+} SchedSlot;
+
+typedef struct scheduler {
+    pthread_mutex_t lock;
+    pthread_cond_t slotFreed;
+    CommandSink put;                /* takes the ready commands */
+    void *sink;
+    SchedSlot *slots;               /* ticket t is in slot t % window */
+    unsigned long window;
+    unsigned long nextTicket;
+    unsigned long pending;          /* submitted and waiting */
+    SchedEntry *buckets[SCHED_BUCKETS];
+    /* counters */
+    unsigned long submitted;
+    unsigned long deferred;         /* commands that had to wait */
+    unsigned long edges;
+    unsigned long maxPending;
+} Scheduler;
+
+
+int sched_init(Scheduler *sched, CommandSink put, void *sink, int window);
+void sched_destroy(Scheduler *sched);
+void sched_submit(Scheduler *sched, Command *commands, int n);
+void sched_complete(Scheduler *sched, Command *commands, int n);
+void sched_finish(Scheduler *sched);
+void sched_print_stats(FILE *fp, Scheduler *sched);
+
+#endif /* SCHEDULER_H */
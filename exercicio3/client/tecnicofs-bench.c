@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "../tecnicofs-api-constants.h"
+#include "./tecnicofs-client-api.h"
+
+/*
+ * Multi-client benchmark of the server. For each number of clients of a
+ * list, forks that many client processes (the API mounts one socket per
+ * process), each working in a directory of its own: it creates a file,
+ * looks it up and deletes it, until it has done its operations. The
+ * clients start together once all are mounted, and a run lasts until the
+ * last one exits. Prints one JSON object per line, one per run.
+ *
+ * The speedup of the server's workers is the ratio between runs against
+ * servers started with different threads_number.
+ */
+#define BENCH_CLIENTS "1,2,4,8,16"
+#define BENCH_OPS 6000
+#define BENCH_MAX_CLIENTS 256
+
+
+static void displayUsage (const char* appName) {
+    printf("Usage: %s server_socket_name [clients] [ops_per_client]\n"
+           "  clients: list of numbers of clients, as 1,2,4\n", appName);
+    exit(EXIT_FAILURE);
+}
+
+static unsigned long benchNow() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+/*
+ * Body of a client process: mounts and creates its directory, tells if it
+ * is ready ('r') or failed ('f'), and once started runs its operations.
+ * Returns: exit status of the process
+ */
+static int runClient(char *serverName, long ops, int ready, int start) {
+    char dir[32], file[MAX_FILE_NAME];
+    char go;
+
+    if (tfsMount(serverName) != 0) {
+        write(ready, "f", 1);
+        return EXIT_FAILURE;
+    }
+    snprintf(dir, sizeof(dir), "/bench%d", (int) getpid());
+    if (tfsCreate(dir, 'd') != 0) {
+        fprintf(stderr, "Error: can't create %s\n", dir);
+        write(ready, "f", 1);
+        tfsUnmount();
+        return EXIT_FAILURE;
+    }
+    if (write(ready, "r", 1) != 1 || read(start, &go, 1) != 0) {
+        tfsUnmount();
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (long i = 0; i < ops && status == EXIT_SUCCESS; i++) {
+        snprintf(file, sizeof(file), "%s/f%ld", dir, i / 3);
+        switch (i % 3) {
+            case 0:
+                status = tfsCreate(file, 'f') == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+                break;
+            case 1:
+                status = tfsLookup(file) >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+                break;
+            default:
+                status = tfsDelete(file) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (status != EXIT_SUCCESS) {
+            fprintf(stderr, "Error: operation %ld on %s failed\n", i, file);
+        }
+    }
+    /* a file left by an odd number of operations */
+    if (ops % 3 != 0) {
+        tfsDelete(file);
+    }
+    tfsDelete(dir);
+    tfsUnmount();
+    return status;
+}
+
+/*
+ * Runs a number of clients against the server and prints the run.
+ * Returns: 0 if every client succeeded, -1 otherwise
+ */
+static int runClients(char *serverName, int clients, long ops) {
+    int ready[2], start[2];
+    char r;
+
+    if (pipe(ready) != 0 || pipe(start) != 0) {
+        perror("Error: can't create pipes");
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+    for (int i = 0; i < clients; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("Error: can't fork");
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            close(ready[0]);
+            close(start[1]);
+            exit(runClient(serverName, ops, ready[1], start[0]));
+        }
+    }
+    close(ready[1]);
+    close(start[0]);
+
+    /* every client answers once, even if it failed */
+    int answered = 0, mounted = 0;
+    while (answered < clients && read(ready[0], &r, 1) == 1) {
+        answered++;
+        mounted += r == 'r';
+    }
+    unsigned long begin = benchNow();
+    close(start[1]);
+
+    int failed = mounted < clients;
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            failed = 1;
+        }
+    }
+    double seconds = (benchNow() - begin) / 1e9;
+    close(ready[0]);
+
+    if (failed) {
+        fprintf(stderr, "Error: a client of the run with %d failed\n", clients);
+        return -1;
+    }
+    printf("{\"clients\": %d, \"ops_per_client\": %ld, \"ops\": %ld, "
+           "\"seconds\": %.4f, \"ops_per_sec\": %.0f}\n",
+           clients, ops, clients * ops, seconds, clients * ops / seconds);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int clientCounts[BENCH_MAX_CLIENTS];
+    int n = 0;
+
+    if (argc < 2 || argc > 4) {
+        displayUsage(argv[0]);
+    }
+    char *list = argc > 2 ? argv[2] : BENCH_CLIENTS;
+    long ops = argc > 3 ? atol(argv[3]) : BENCH_OPS;
+    char counts[strlen(list) + 1];
+
+    if (ops <= 0) {
+        displayUsage(argv[0]);
+    }
+    strcpy(counts, list);
+    for (char *count = strtok(counts, ","); count != NULL; count = strtok(NULL, ",")) {
+        if (n == BENCH_MAX_CLIENTS || (clientCounts[n++] = atoi(count)) <= 0 ||
+            clientCounts[n - 1] > BENCH_MAX_CLIENTS) {
+            displayUsage(argv[0]);
+        }
+    }
+    if (n == 0) {
+        displayUsage(argv[0]);
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (runClients(argv[1], clientCounts[i], ops) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        fflush(stdout);
+    }
+    exit(EXIT_SUCCESS);
+}
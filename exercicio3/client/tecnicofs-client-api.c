@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <stdio.h>
 
 #define CLIENT_SOCKET "/tmp/client_socket92"
@@ -12,6 +13,8 @@ int sockfd;
 struct sockaddr_un serv_addr, client_addr;
 socklen_t servlen, clilen;
 char *server_path, *client_path;
+/* one socket per client process, so several clients can be mounted */
+char client_socket[sizeof(CLIENT_SOCKET) + 16];
 
 
 int setSockAddrUn(char *path, struct sockaddr_un *addr) { //sets socketaddr_un members
@@ -25,21 +28,38 @@ int setSockAddrUn(char *path, struct sockaddr_un *addr) { //sets socketaddr_un m
     return SUN_LEN(addr);
 }
 
-int sendAndRecv(char *comando){
+/*
+ * Sends a command of len bytes and receives its return value, followed by
+ * up to buflen bytes into buf for a read.
+ */
+int sendAndRecvData(char *comando, size_t len, char *buf, size_t buflen){
     int return_value;
+    struct iovec iov[2] = {
+        { .iov_base = &return_value, .iov_len = sizeof(return_value) },
+        { .iov_base = buf, .iov_len = buflen }
+    };
+    struct msghdr msg;
+
     /* Envia comando para servidor */
-    if (sendto(sockfd, comando, strlen(comando) + 1, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
+    if (sendto(sockfd, comando, len, 0, (struct sockaddr *) &serv_addr, servlen) < 0) {
         perror("client: sendto error");
         return EXIT_FAILURE;
 	}
     /* Recebe o valor de retorno */
-    if (recvfrom(sockfd, &return_value, sizeof(return_value), 0, 0, 0) < 0) {
-        perror("client: recvfrom error");
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = buf != NULL ? 2 : 1;
+    if (recvmsg(sockfd, &msg, 0) < 0) {
+        perror("client: recvmsg error");
         return EXIT_FAILURE;
     }
     return return_value;
 }
 
+int sendAndRecv(char *comando){
+    return sendAndRecvData(comando, strlen(comando) + 1, NULL, 0);
+}
+
 int tfsCreate(char *filename, char nodeType) {
     char comando[1024];
 
@@ -57,7 +77,11 @@ int tfsDelete(char *path) {
 }
 
 int tfsMove(char *from, char *to) {
-	return -1;
+    char comando[1024];
+
+    sprintf(comando, "m %s %s", from, to);
+
+	return sendAndRecv(comando);
 }
 
 int tfsLookup(char *path) {
@@ -68,6 +92,26 @@ int tfsLookup(char *path) {
 	return sendAndRecv(comando);
 }
 
+int tfsWrite(char *path, char *buf, size_t len, size_t offset) {
+    char comando[1024];
+    int header = snprintf(comando, sizeof(comando), "w %s %lu ", path, (unsigned long) offset);
+
+    if (len > sizeof(comando) - header) {
+        return TECNICOFS_ERROR_OTHER;
+    }
+    memcpy(comando + header, buf, len);
+
+    return sendAndRecvData(comando, header + len, NULL, 0);
+}
+
+int tfsRead(char *path, char *buf, size_t len, size_t offset) {
+    char comando[1024];
+
+    sprintf(comando, "r %s %lu %lu", path, (unsigned long) offset, (unsigned long) len);
+
+    return sendAndRecvData(comando, strlen(comando) + 1, buf, len);
+}
+
 int tfsPrint(char *filename){
     char comando[1024];
 
@@ -83,8 +127,10 @@ int tfsMount(char *path) {
         return EXIT_FAILURE;
     }
 
-    unlink(CLIENT_SOCKET);
-    clilen = setSockAddrUn (CLIENT_SOCKET, &client_addr);
+    snprintf(client_socket, sizeof(client_socket), "%s.%d", CLIENT_SOCKET, (int) getpid());
+    client_path = client_socket;
+    unlink(client_path);
+    clilen = setSockAddrUn (client_path, &client_addr);
     if (bind(sockfd, (struct sockaddr *) &client_addr, clilen) < 0) {
         perror("client: bind error");
         return EXIT_FAILURE;
@@ -96,7 +142,7 @@ int tfsMount(char *path) {
 
 int tfsUnmount() {
     close(sockfd);
-    unlink(CLIENT_SOCKET);
+    unlink(client_path);
 
 	return 0;
 }
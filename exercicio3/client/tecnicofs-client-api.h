@@ -1,12 +1,15 @@
 #ifndef API_H
 #define API_H
 
+#include <stddef.h>
 #include "tecnicofs-api-constants.h"
 
 int tfsCreate(char *path, char nodeType);
 int tfsDelete(char *path);
 int tfsLookup(char *path);
 int tfsMove(char *from, char *to);
+int tfsWrite(char *path, char *buf, size_t len, size_t offset);
+int tfsRead(char *path, char *buf, size_t len, size_t offset);
 int tfsPrint(char *filename);
 int tfsMount(char *path);
 int tfsUnmount();
@@ -15,6 +15,8 @@
 #include "../tecnicofs-api-constants.h"
 #include "./tecnicofs-client-api.h"
 
+/* bytes a read asks for at most */
+#define READ_BUFFER_SIZE 4096
 
 FILE* inputFile;
 char* serverName;
@@ -113,6 +115,30 @@ void *processInput() {
                 else
                   printf("Unable to move: %s to %s\n", arg1, arg2);
                 break;
+            case 'w': {
+                unsigned long offset;
+                char data[MAX_INPUT_SIZE];
+                if (sscanf(line, "%c %s %lu %[^\n]", &op, arg1, &offset, data) != 4)
+                    errorParse();
+                res = tfsWrite(arg1, data, strlen(data), offset);
+                if (res >= 0)
+                  printf("Wrote %d bytes to: %s\n", res, arg1);
+                else
+                  printf("Unable to write to: %s\n", arg1);
+                break;
+            }
+            case 'r': {
+                unsigned long offset, len;
+                char data[READ_BUFFER_SIZE];
+                if (sscanf(line, "%c %s %lu %lu", &op, arg1, &offset, &len) != 4)
+                    errorParse();
+                res = tfsRead(arg1, data, len < sizeof(data) ? len : sizeof(data), offset);
+                if (res >= 0)
+                  printf("Read: %s: %.*s\n", arg1, res, data);
+                else
+                  printf("Unable to read: %s\n", arg1);
+                break;
+            }
             case 'p':
                 if (numTokens != 2)
                     errorParse();
@@ -0,0 +1,196 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "command.h"
+#include "fs/path.h"
+#include "fs/state.h"
+
+/* arguments of the longest commands, a write or a read */
+#define COMMAND_MAX_ARGS 3
+
+
+/*
+ * Copies a path into the text of a command, hashing its canonical form
+ * on the way, as path_parse does.
+ * Input:
+ *  - command: the command
+ *  - span: span to fill
+ *  - start: first free char of text
+ *  - name, len: the path, as read
+ */
+static void command_copy_path(Command *command, CommandPath *span, int start,
+                              const char *name, int len) {
+    unsigned int hash = PATH_HASH_INIT;
+    int depth = 0;
+    int in_component = 0;
+
+    memcpy(command->text + start, name, len);
+    command->text[start + len] = '\0';
+    for (int i = 0; i < len; i++) {
+        if (name[i] == '/') {
+            in_component = 0;
+            continue;
+        }
+        if (!in_component) {
+            if (depth > 0) {
+                hash = PATH_HASH_STEP(hash, '/');
+            }
+            depth++;
+            in_component = 1;
+        }
+        hash = PATH_HASH_STEP(hash, name[i]);
+    }
+    span->start = start;
+    span->len = len;
+    span->depth = depth;
+    span->hash = hash;
+}
+
+/*
+ * Parses a number argument of a command.
+ * Input:
+ *  - arg, len: the argument
+ *  - value: reference to store the number
+ * Returns: SUCCESS, or FAIL if it is not a number
+ */
+static int command_number(const char *arg, int len, unsigned long *value) {
+    char *end;
+
+    if (!isdigit((unsigned char) arg[0])) {
+        return FAIL;
+    }
+    errno = 0;
+    *value = strtoul(arg, &end, 10);
+    return end == arg + len && errno == 0 ? SUCCESS : FAIL;
+}
+
+/*
+ * Parses a command line: the operation is its first char, the arguments
+ * follow separated by blanks. The data of a write, its last argument, is
+ * the rest of the line without its newline, blanks included.
+ * Input:
+ *  - line: the command line
+ *  - command: reference to store the command
+ * Returns: SUCCESS, or FAIL if the operation is unknown, the number of
+ *  arguments is wrong or a path is too long
+ */
+int command_parse(const char *line, Command *command) {
+    const char *args[COMMAND_MAX_ARGS];
+    int lens[COMMAND_MAX_ARGS];
+    int nargs = 0;
+    const char *c = line + 1;
+
+    command->op = line[0];
+    if (command->op == '#') {
+        return SUCCESS;
+    }
+    for (;;) {
+        while (isspace((unsigned char) *c)) {
+            c++;
+        }
+        if (*c == '\0') {
+            break;
+        }
+        if (nargs == COMMAND_MAX_ARGS) {
+            return FAIL;
+        }
+        args[nargs] = c;
+        if (command->op == 'w' && nargs == 2) {
+            size_t rest = strlen(c);
+            c += rest;
+            lens[nargs] = rest > 0 && c[-1] == '\n' ? rest - 1 : rest;
+        }
+        else {
+            while (*c != '\0' && !isspace((unsigned char) *c)) {
+                c++;
+            }
+            lens[nargs] = c - args[nargs];
+        }
+        if (lens[nargs] >= MAX_FILE_NAME) {
+            return FAIL;
+        }
+        nargs++;
+    }
+
+    switch (command->op) {
+        case 'c':
+            if (nargs != 2) {
+                return FAIL;
+            }
+            switch (args[1][0]) {
+                case 'f':
+                    command->nodeType = T_FILE;
+                    break;
+                case 'd':
+                    command->nodeType = T_DIRECTORY;
+                    break;
+                default:
+                    return FAIL;
+            }
+            break;
+
+        case 'm':
+            if (nargs != 2) {
+                return FAIL;
+            }
+            command_copy_path(command, &command->target, lens[0] + 1, args[1], lens[1]);
+            break;
+
+        case 'w':
+            if (nargs != 3 || command_number(args[1], lens[1], &command->offset) == FAIL) {
+                return FAIL;
+            }
+            command->len = lens[2];
+            memcpy(command->text + lens[0] + 1, args[2], lens[2]);
+            break;
+
+        case 'r': {
+            unsigned long len;
+            if (nargs != 3 || command_number(args[1], lens[1], &command->offset) == FAIL ||
+                command_number(args[2], lens[2], &len) == FAIL || len > UINT_MAX) {
+                return FAIL;
+            }
+            command->len = len;
+            break;
+        }
+
+        case 'l':
+        case 'd':
+        case 'p':
+            if (nargs != 1) {
+                return FAIL;
+            }
+            break;
+
+        case 'q':
+            return nargs == 0 ? SUCCESS : FAIL;
+
+        default:
+            return FAIL;
+    }
+    command_copy_path(command, &command->path, 0, args[0], lens[0]);
+    return SUCCESS;
+}
+
+/*
+ * Returns: the path of a command, NUL terminated
+ */
+char *command_path(Command *command) {
+    return command->text + command->path.start;
+}
+
+/*
+ * Returns: the new path of a move, NUL terminated
+ */
+char *command_target(Command *command) {
+    return command->text + command->target.start;
+}
+
+/*
+ * Returns: the data of a write, of len bytes
+ */
+char *command_data(Command *command) {
+    return command->text + command->path.len + 1;
+}
@@ -0,0 +1,45 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "tecnicofs-api-constants.h"
+
+/*
+ * A command line parsed once, by the thread that reads it, so the threads
+ * that apply it do not scan text again. Its paths are copied into text,
+ * NUL terminated, and located by spans; the data of a write follows its
+ * path. Each span also holds the depth and the hash of the canonical path
+ * (see fs/path.h), so commands on the same path can be told apart without
+ * comparing strings.
+ */
+#define COMMAND_TEXT_SIZE (2 * MAX_FILE_NAME)
+
+
+/* a path of a command, in text */
+typedef struct commandPath {
+    unsigned char start;
+    unsigned char len;
+    unsigned char depth;        /* number of components */
+    unsigned int hash;          /* hash of the canonical path */
+} CommandPath;
+
+typedef struct command {
+    char op;                    /* 'c', 'l', 'd', 'm', 'w', 'r', 'p', 'q' or '#' */
+    char nodeType;              /* T_FILE or T_DIRECTORY, for 'c' */
+    CommandPath path;           /* the node, or the output file of 'p' */
+    CommandPath target;         /* new path of the node, for 'm' */
+    unsigned long offset;       /* position in the file, for 'w' and 'r' */
+    unsigned int len;           /* bytes of data for 'w', to read for 'r' */
+    unsigned long ticket;       /* position in the trace, set by the scheduler */
+    char text[COMMAND_TEXT_SIZE];
+} Command;
+
+
+int command_parse(const char *line, Command *command);
+char *command_path(Command *command);
+char *command_target(Command *command);
+char *command_data(Command *command);
+
+/* takes n commands in order, copying them; may block */
+typedef void (*CommandSink)(void *sink, Command *commands, int n);
+
+#endif /* COMMAND_H */
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "bravo.h"
+
+
+/* fast read locks held by a thread, with the slot each one took */
+typedef struct bravoHeld {
+    BravoLock *lock;
+    BravoLock **slot;
+} BravoHeld;
+
+/* visible readers: a slot holds the lock its reader has read locked */
+static BravoLock *visible_readers[BRAVO_SLOTS] __attribute__((aligned(64)));
+static unsigned int next_thread_id = 0;
+
+/* whether locks are ever biased, off with TECNICOFS_BRAVO=0 */
+static int bias_enabled = 1;
+
+static __thread BravoHeld held[BRAVO_MAX_HELD];
+static __thread int nheld = 0;
+static __thread unsigned int thread_id = 0;
+
+
+static unsigned long bravo_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * Returns the slot of the visible readers table for the calling thread
+ * and a lock.
+ */
+static BravoLock **bravo_slot(BravoLock *lock) {
+    if (thread_id == 0) {
+        thread_id = __atomic_add_fetch(&next_thread_id, 1, __ATOMIC_RELAXED);
+    }
+    unsigned int h = (unsigned int) ((uintptr_t) lock >> 6) ^ (thread_id * 0x9E3779B1u);
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return &visible_readers[h & (BRAVO_SLOTS - 1)];
+}
+
+/*
+ * Read locks a biased lock by publishing it in the visible readers table.
+ * Returns: 1 if the lock was taken, 0 if it has to go to the underlying lock
+ */
+static int bravo_fast_read(BravoLock *lock) {
+    if (!__atomic_load_n(&lock->rbias, __ATOMIC_ACQUIRE) || nheld == BRAVO_MAX_HELD) {
+        return 0;
+    }
+    BravoLock **slot = bravo_slot(lock);
+    BravoLock *expected = NULL;
+    if (__atomic_load_n(slot, __ATOMIC_RELAXED) != NULL ||
+        !__atomic_compare_exchange_n(slot, &expected, lock, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    /* a writer clears rbias before it scans the table */
+    if (__atomic_load_n(&lock->rbias, __ATOMIC_SEQ_CST)) {
+        held[nheld].lock = lock;
+        held[nheld].slot = slot;
+        nheld++;
+        return 1;
+    }
+    __atomic_store_n(slot, NULL, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Counts a read that went through the underlying lock, and biases the
+ * lock once enough of them happened since the last write.
+ * Must be called with the underlying lock read locked.
+ */
+static void bravo_slow_read(BravoLock *lock) {
+    if (!bias_enabled || __atomic_load_n(&lock->rbias, __ATOMIC_RELAXED)) {
+        return;
+    }
+    unsigned int reads = __atomic_add_fetch(&lock->slow_reads, 1, __ATOMIC_RELAXED);
+    if (reads >= BRAVO_READ_RATIO &&
+        bravo_now() >= __atomic_load_n(&lock->inhibit_until, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&lock->rbias, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * Revokes the bias of a lock and waits for its visible readers to leave.
+ * Must be called with the underlying lock write locked.
+ * Input:
+ *  - lock: the lock
+ *  - wait: 0 to give up instead of waiting for a reader
+ * Returns: 0, or EBUSY if a reader is still in and wait is 0
+ */
+static int bravo_revoke(BravoLock *lock, int wait) {
+    __atomic_store_n(&lock->slow_reads, 0, __ATOMIC_RELAXED);
+    if (!__atomic_load_n(&lock->rbias, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    __atomic_store_n(&lock->rbias, 0, __ATOMIC_SEQ_CST);
+
+    unsigned long start = bravo_now();
+    for (int i = 0; i < BRAVO_SLOTS; i++) {
+        while (__atomic_load_n(&visible_readers[i], __ATOMIC_ACQUIRE) == lock) {
+            if (!wait) {
+                return EBUSY;
+            }
+            sched_yield();
+        }
+    }
+    /* the more a revocation costs, the longer the lock stays unbiased */
+    unsigned long now = bravo_now();
+    __atomic_store_n(&lock->inhibit_until, now + (now - start) * BRAVO_INHIBIT, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+/*
+ * Reads TECNICOFS_BRAVO, before any lock is used: 0 leaves every lock a
+ * plain read-write lock, to compare against.
+ */
+void bravo_configure() {
+    char *bias = getenv("TECNICOFS_BRAVO");
+
+    bias_enabled = bias == NULL || strcmp(bias, "0") != 0;
+}
+
+/*
+ * Initializes a lock, unbiased.
+ * Returns: 0, or the error of pthread_rwlock_init
+ */
+int bravo_init(BravoLock *lock) {
+    lock->rbias = 0;
+    lock->slow_reads = 0;
+    lock->inhibit_until = 0;
+    return pthread_rwlock_init(&lock->lock, NULL);
+}
+
+int bravo_destroy(BravoLock *lock) {
+    return pthread_rwlock_destroy(&lock->lock);
+}
+
+/*
+ * Lock functions: each behaves like the pthread_rwlock function it is
+ * named after, and returns 0 or its error.
+ */
+int bravo_rdlock(BravoLock *lock) {
+    if (bravo_fast_read(lock)) {
+        return 0;
+    }
+    int err = pthread_rwlock_rdlock(&lock->lock);
+    if (err == 0) {
+        bravo_slow_read(lock);
+    }
+    return err;
+}
+
+int bravo_tryrdlock(BravoLock *lock) {
+    if (bravo_fast_read(lock)) {
+        return 0;
+    }
+    int err = pthread_rwlock_tryrdlock(&lock->lock);
+    if (err == 0) {
+        bravo_slow_read(lock);
+    }
+    return err;
+}
+
+int bravo_wrlock(BravoLock *lock) {
+    int err = pthread_rwlock_wrlock(&lock->lock);
+
+    if (err == 0) {
+        bravo_revoke(lock, 1);
+    }
+    return err;
+}
+
+/*
+ * Does not wait for visible readers either: a reader that is walking a
+ * path may be waiting for a lock the caller holds.
+ */
+int bravo_trywrlock(BravoLock *lock) {
+    int err = pthread_rwlock_trywrlock(&lock->lock);
+
+    if (err == 0 && bravo_revoke(lock, 0) != 0) {
+        pthread_rwlock_unlock(&lock->lock);
+        return EBUSY;
+    }
+    return err;
+}
+
+int bravo_unlock(BravoLock *lock) {
+    for (int i = nheld - 1; i >= 0; i--) {
+        if (held[i].lock == lock) {
+            __atomic_store_n(held[i].slot, NULL, __ATOMIC_RELEASE);
+            held[i] = held[--nheld];
+            return 0;
+        }
+    }
+    return pthread_rwlock_unlock(&lock->lock);
+}
@@ -0,0 +1,238 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "dcache.h"
+#include "state.h"
+
+
+typedef struct dentry {
+    int len;            /* 0 while the entry is unused */
+    int inumber;        /* FAIL for a negative entry */
+    unsigned int hash;
+    unsigned int generation;
+    unsigned int moves;     /* moves to or from the prefixes of path, when cached */
+    unsigned int total;     /* moves in all, when moves was last checked */
+    char path[MAX_FILE_NAME];
+} Dentry;
+
+typedef struct dcacheBucket {
+    pthread_mutex_t lock;
+    unsigned int version;   /* bumped by every invalidation */
+    int victim;             /* next way to replace */
+    unsigned long hits;
+    unsigned long misses;
+    Dentry ways[DCACHE_WAYS];
+} __attribute__((aligned(64))) DcacheBucket;
+
+static DcacheBucket buckets[DCACHE_BUCKETS];
+
+/* moves done to or from each path, by path hash; paths that collide share
+ * a counter, which only costs entries that were still good */
+static unsigned int subtree_moves[DCACHE_SUBTREES];
+/* moves done, bumped after the counter of their paths */
+static unsigned int total_moves = 0;
+
+
+static DcacheBucket *dcache_bucket(Path *path, int depth) {
+    return &buckets[path->components[depth - 1].prefix_hash & (DCACHE_BUCKETS - 1)];
+}
+
+/*
+ * Returns the sum of the move counters of the prefixes of a path. The
+ * counters only grow, so the sum changes whenever one of them does.
+ */
+static unsigned int dcache_moves(Path *path, int depth) {
+    unsigned int moves = 0;
+
+    for (int i = 0; i < depth; i++) {
+        unsigned int slot = path->components[i].prefix_hash & (DCACHE_SUBTREES - 1);
+        moves += __atomic_load_n(&subtree_moves[slot], __ATOMIC_ACQUIRE);
+    }
+    return moves;
+}
+
+/*
+ * Returns the way of a bucket holding a path, or NULL.
+ * Must be called with the bucket lock held.
+ */
+static Dentry *dcache_find(DcacheBucket *bucket, Path *path, int depth) {
+    unsigned int hash = path->components[depth - 1].prefix_hash;
+
+    for (int w = 0; w < DCACHE_WAYS; w++) {
+        Dentry *entry = &bucket->ways[w];
+        if (entry->len > 0 && entry->hash == hash &&
+            path_prefix_matches(path, depth, entry->path, entry->len)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * Checks that no prefix of the path of an entry was moved since the entry
+ * was cached. Must be called with the bucket lock held.
+ * Input:
+ *  - entry: entry of the path
+ *  - path, depth: the path
+ *  - total: total_moves, read before
+ * Returns: 1 if the entry still holds, 0 otherwise
+ */
+static int dcache_valid(Dentry *entry, Path *path, int depth, unsigned int total) {
+    if (entry->total == total) {
+        return 1;
+    }
+    if (entry->moves != dcache_moves(path, depth)) {
+        return 0;
+    }
+    /* every move in total had bumped its counter, and none was ours */
+    entry->total = total;
+    return 1;
+}
+
+
+/*
+ * Initializes the cache, empty.
+ */
+void dcache_init() {
+    for (int b = 0; b < DCACHE_BUCKETS; b++) {
+        memset(&buckets[b], 0, sizeof(DcacheBucket));
+        pthread_mutex_init(&buckets[b].lock, NULL);
+    }
+    memset(subtree_moves, 0, sizeof(subtree_moves));
+    total_moves = 0;
+}
+
+void dcache_destroy() {
+    for (int b = 0; b < DCACHE_BUCKETS; b++) {
+        pthread_mutex_destroy(&buckets[b].lock);
+    }
+}
+
+/*
+ * Looks up the first components of a path in the cache.
+ * Input:
+ *  - path: parsed path
+ *  - depth: number of components, at least 1
+ *  - generation: reference to store the generation of the cached i-node
+ *  - stamp: reference to store the state to give dcache_put, if the path
+ *    is walked anyway
+ * Returns:
+ *      inumber: cached i-number of the path
+ *         FAIL: the path is cached as not existing
+ *   DCACHE_MISS: the path is not cached
+ */
+int dcache_get(Path *path, int depth, unsigned int *generation, DcacheStamp *stamp) {
+    DcacheBucket *bucket = dcache_bucket(path, depth);
+    int inumber = DCACHE_MISS;
+
+    unsigned int total = __atomic_load_n(&total_moves, __ATOMIC_ACQUIRE);
+
+    pthread_mutex_lock(&bucket->lock);
+    stamp->version = bucket->version;
+    stamp->total = total;
+    Dentry *entry = dcache_find(bucket, path, depth);
+    if (entry != NULL && dcache_valid(entry, path, depth, total)) {
+        inumber = entry->inumber;
+        *generation = entry->generation;
+        /* the walk done if the i-node was reused since needs it too */
+        stamp->moves = entry->moves;
+        bucket->hits++;
+    }
+    else {
+        stamp->moves = dcache_moves(path, depth);
+        bucket->misses++;
+    }
+    pthread_mutex_unlock(&bucket->lock);
+    return inumber;
+}
+
+/*
+ * Caches the result of a path walk, replacing the entry of the path if
+ * there is one. Nothing is cached if the path was invalidated, or one of
+ * its prefixes moved, since the stamp was taken.
+ * Input:
+ *  - path: parsed path
+ *  - depth: number of components, at least 1
+ *  - inumber: i-number of the path, or FAIL if it does not exist
+ *  - generation: generation of the i-node
+ *  - stamp: filled by the dcache_get done before the walk
+ */
+void dcache_put(Path *path, int depth, int inumber, unsigned int generation, DcacheStamp stamp) {
+    DcacheBucket *bucket = dcache_bucket(path, depth);
+
+    pthread_mutex_lock(&bucket->lock);
+    if (bucket->version == stamp.version && dcache_moves(path, depth) == stamp.moves) {
+        Dentry *entry = dcache_find(bucket, path, depth);
+        if (entry == NULL) {
+            entry = &bucket->ways[bucket->victim];
+            bucket->victim = (bucket->victim + 1) % DCACHE_WAYS;
+        }
+        /* the only copy of the path, made once per cached entry */
+        path_copy_prefix(path, depth, entry->path);
+        entry->len = path->components[depth - 1].prefix_len;
+        entry->hash = path->components[depth - 1].prefix_hash;
+        entry->inumber = inumber;
+        entry->generation = generation;
+        entry->moves = stamp.moves;
+        entry->total = stamp.total;
+    }
+    pthread_mutex_unlock(&bucket->lock);
+}
+
+/*
+ * Drops the entry of a path, after the path was created or deleted.
+ * Must be called after the change is made to the tree.
+ * Input:
+ *  - path: parsed path
+ *  - depth: number of components, at least 1
+ */
+void dcache_invalidate(Path *path, int depth) {
+    DcacheBucket *bucket = dcache_bucket(path, depth);
+
+    pthread_mutex_lock(&bucket->lock);
+    bucket->version++;
+    Dentry *entry = dcache_find(bucket, path, depth);
+    if (entry != NULL) {
+        entry->len = 0;
+    }
+    pthread_mutex_unlock(&bucket->lock);
+}
+
+/*
+ * Drops the entries of a path and of every path below it, after a node
+ * was moved from or to it. Entries of other paths are kept.
+ * Must be called after the change is made to the tree.
+ * Input:
+ *  - path: parsed path
+ *  - depth: number of components, at least 1
+ */
+void dcache_invalidate_subtree(Path *path, int depth) {
+    unsigned int slot = path->components[depth - 1].prefix_hash & (DCACHE_SUBTREES - 1);
+
+    __atomic_add_fetch(&subtree_moves[slot], 1, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&total_moves, 1, __ATOMIC_ACQ_REL);
+}
+
+/*
+ * Sums the hit and miss counters of all buckets.
+ */
+void dcache_stats(unsigned long *hits, unsigned long *misses) {
+    *hits = 0;
+    *misses = 0;
+    for (int b = 0; b < DCACHE_BUCKETS; b++) {
+        pthread_mutex_lock(&buckets[b].lock);
+        *hits += buckets[b].hits;
+        *misses += buckets[b].misses;
+        pthread_mutex_unlock(&buckets[b].lock);
+    }
+}
+
+void dcache_print_stats(FILE *fp) {
+    unsigned long hits, misses;
+
+    dcache_stats(&hits, &misses);
+    fprintf(fp, "dcache: %lu hits, %lu misses (%.1f%% hit rate)\n", hits, misses,
+            hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0);
+}
@@ -0,0 +1,49 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdio.h>
+#include "../tecnicofs-api-constants.h"
+#include "path.h"
+
+/*
+ * Cache of full paths to i-numbers, in front of the path walk done by
+ * lookup. Paths are kept in canonical form (see path.h). Misses are
+ * cached too, as negative entries. The table has DCACHE_BUCKETS buckets of
+ * DCACHE_WAYS entries, each bucket with its own lock.
+ *
+ * A move changes every path below its source and its target. Instead of
+ * finding their entries, it bumps a counter kept for each of the two
+ * paths, in a table of DCACHE_SUBTREES counters indexed by path hash. An
+ * entry records the sum of the counters of its path's prefixes and is
+ * ignored once that sum changes. It also records the number of moves done
+ * when the sum was last checked, so hits after no move skip the check.
+ */
+#define DCACHE_BUCKETS 1024
+#define DCACHE_WAYS 4
+#define DCACHE_SUBTREES 1024
+
+/* returned by dcache_get when the path is not cached */
+#define DCACHE_MISS -2
+
+
+/*
+ * Taken by dcache_get on a miss and handed back to dcache_put, so a walk
+ * that raced with an invalidation does not cache its stale result.
+ */
+typedef struct dcacheStamp {
+	unsigned int version;
+	unsigned int moves;
+	unsigned int total;
+} DcacheStamp;
+
+
+void dcache_init();
+void dcache_destroy();
+int dcache_get(Path *path, int depth, unsigned int *generation, DcacheStamp *stamp);
+void dcache_put(Path *path, int depth, int inumber, unsigned int generation, DcacheStamp stamp);
+void dcache_invalidate(Path *path, int depth);
+void dcache_invalidate_subtree(Path *path, int depth);
+void dcache_stats(unsigned long *hits, unsigned long *misses);
+void dcache_print_stats(FILE *fp);
+
+#endif /* DCACHE_H */
@@ -0,0 +1,446 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "state.h"
+#include "directory.h"
+#include "dirscan.h"
+#include "slab.h"
+#include "namepool.h"
+#include "seqlock.h"
+#include "epoch.h"
+
+
+/*
+ * Returns the name stored in a slot.
+ */
+static char *dir_slot_name(DirName *name) {
+    char *pooled;
+
+    if (name->len <= DIR_SHORT_NAME) {
+        return name->chars;
+    }
+    memcpy(&pooled, name->chars, sizeof(pooled));
+    return pooled;
+}
+
+/*
+ * Fills a slot that is not in use.
+ * Returns: SUCCESS or FAIL (long name and out of memory)
+ */
+static int dir_slot_set(Directory *dir, int slot, char *name, int len, unsigned int hash, int inumber) {
+    DirName *dname = &dir->names[slot];
+
+    if (len <= DIR_SHORT_NAME) {
+        memcpy(dname->chars, name, len);
+        dname->chars[len] = '\0';
+    }
+    else {
+        char *pooled = namepool_intern(name, len, hash);
+        if (pooled == NULL) {
+            return FAIL;
+        }
+        memcpy(dname->chars, &pooled, sizeof(pooled));
+    }
+    dname->len = len;
+    dir->hashes[slot] = hash;
+    dir->inumbers[slot] = inumber;
+    dir->occupied[slot / 64] |= (uint64_t) 1 << (slot % 64);
+    return SUCCESS;
+}
+
+/*
+ * Releases the name of a slot whose entry is being removed.
+ */
+static void dir_slot_clear(Directory *dir, int slot) {
+    if (dir->names[slot].len > DIR_SHORT_NAME) {
+        namepool_release(dir_slot_name(&dir->names[slot]));
+    }
+    dir->names[slot].len = 0;
+    dir->occupied[slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+}
+
+static int dir_bitmap_words(int capacity) {
+    return (capacity + 63) / 64;
+}
+
+static size_t dir_slots_size(int capacity) {
+    return dir_bitmap_words(capacity) * sizeof(uint64_t) +
+           (size_t) capacity * (sizeof(int) + sizeof(unsigned int) + sizeof(DirName));
+}
+
+/*
+ * Returns the next slot holding an entry, at or after slot, or
+ * dir->capacity if there is none.
+ */
+static int dir_next_occupied(Directory *dir, int slot) {
+    int words = dir_bitmap_words(dir->capacity);
+
+    if (slot >= dir->capacity) {
+        return dir->capacity;
+    }
+    int w = slot / 64;
+    uint64_t bits = dir->occupied[w] & (~(uint64_t) 0 << (slot % 64));
+    while (bits == 0) {
+        if (++w == words) {
+            return dir->capacity;
+        }
+        bits = dir->occupied[w];
+    }
+    return w * 64 + __builtin_ctzll(bits);
+}
+
+/*
+ * Allocates the slot arrays of a directory, all free.
+ * Input:
+ *  - slots: directory whose arrays and capacity are set
+ *  - capacity: number of slots
+ * Returns: SUCCESS or FAIL
+ */
+static int dir_slots_alloc(Directory *slots, int capacity) {
+    char *block = slab_alloc(dir_slots_size(capacity));
+
+    if (block == NULL) {
+        return FAIL;
+    }
+    slots->occupied = (uint64_t *) block;
+    block += dir_bitmap_words(capacity) * sizeof(uint64_t);
+    slots->inumbers = (int *) block;
+    slots->hashes = (unsigned int *) (block + capacity * sizeof(int));
+    slots->names = (DirName *) (block + capacity * (sizeof(int) + sizeof(unsigned int)));
+    slots->capacity = capacity;
+    memset(slots->occupied, 0, dir_bitmap_words(capacity) * sizeof(uint64_t));
+    for (int i = 0; i < capacity; i++) {
+        slots->inumbers[i] = FREE_INODE;
+    }
+    return SUCCESS;
+}
+
+/*
+ * Retires the slot arrays of a directory. Optimistic lookups may still be
+ * reading them, so they are released once those lookups are done.
+ */
+static void dir_slots_free(Directory *slots) {
+    epoch_retire(slots->occupied, dir_slots_size(slots->capacity), slab_free);
+}
+
+/*
+ * Returns the first slot among the candidates whose name matches.
+ * Input:
+ *  - dir: directory
+ *  - base: slot of bit 0 of candidates
+ *  - candidates: live slots whose hash matches
+ *  - name: name of the entry
+ *  - len: length of the name
+ *  - seq, start: for optimistic readers, the sequence counter that guards
+ *    the directory and its value when the read began; NULL otherwise
+ * Returns: the slot, FAIL, or DIR_RETRY if the directory changed
+ */
+static int dir_first_name_match(Directory *dir, int base, uint64_t candidates, char *name, int len,
+                                unsigned int *seq, unsigned int start) {
+    while (candidates != 0) {
+        int slot = base + __builtin_ctzll(candidates);
+        if (dir->names[slot].len == len) {
+            char *chars = dir_slot_name(&dir->names[slot]);
+            /* a pooled name pointer read while the slot changed is garbage */
+            if (seq != NULL && seq_read_retry(seq, start)) {
+                return DIR_RETRY;
+            }
+            if (memcmp(chars, name, len) == 0) {
+                return slot;
+            }
+        }
+        candidates &= candidates - 1;
+    }
+    return FAIL;
+}
+
+/*
+ * Returns the first group of a hash table probe sequence. The table is
+ * probed a group of DIRSCAN_GROUP slots at a time.
+ */
+static int dir_probe_start(Directory *dir, unsigned int hash) {
+    return hash & (dir->capacity - 1) & ~(DIRSCAN_GROUP - 1);
+}
+
+/*
+ * Finds the slot of an entry in a directory.
+ * Input:
+ *  - dir: directory
+ *  - name: name of the entry
+ *  - len: length of the name
+ *  - hash: hash of the name
+ *  - seq, start: as in dir_first_name_match
+ * Returns:
+ *  slot: index of the entry, if found
+ *  FAIL: otherwise
+ *  DIR_RETRY: the directory changed under an optimistic reader
+ */
+static int dir_find_slot(Directory *dir, char *name, int len, unsigned int hash,
+                         unsigned int *seq, unsigned int start) {
+    if (!dir->hashed) {
+        uint64_t candidates = dirscan.match(dir->inumbers, dir->hashes, dir->capacity, hash);
+        return dir_first_name_match(dir, 0, candidates, name, len, seq, start);
+    }
+
+    /* a group with a free slot ends the probe sequence; the bound only
+     * matters to optimistic readers, that may see no free slot at all */
+    int g = dir_probe_start(dir, hash);
+    for (int n = 0; n < dir->capacity / DIRSCAN_GROUP; n++) {
+        uint64_t candidates = dirscan.match(dir->inumbers + g, dir->hashes + g, DIRSCAN_GROUP, hash);
+        int slot = dir_first_name_match(dir, g, candidates, name, len, seq, start);
+        if (slot != FAIL) {
+            return slot;
+        }
+        if (dirscan.free(dir->inumbers + g, DIRSCAN_GROUP) != 0) {
+            return FAIL;
+        }
+        g = (g + DIRSCAN_GROUP) & (dir->capacity - 1);
+    }
+    return FAIL;
+}
+
+/*
+ * Returns the slot where a new entry goes in a hash table: the first slot
+ * not in use along its probe sequence.
+ */
+static int dir_hash_free_slot(Directory *dir, unsigned int hash) {
+    for (int g = dir_probe_start(dir, hash); ; g = (g + DIRSCAN_GROUP) & (dir->capacity - 1)) {
+        uint64_t unused = ~(dir->occupied[g / 64] >> (g % 64)) & ((1 << DIRSCAN_GROUP) - 1);
+        if (unused != 0) {
+            return g + __builtin_ctzll(unused);
+        }
+    }
+}
+
+/*
+ * Moves the live entries of a directory into new slot arrays.
+ * Input:
+ *  - dir: directory
+ *  - hashed: layout of the new arrays
+ *  - capacity: number of slots of the new arrays
+ * Returns: SUCCESS or FAIL
+ */
+static int dir_rebuild(Directory *dir, int hashed, int capacity) {
+    Directory slots;
+
+    if (dir_slots_alloc(&slots, capacity) == FAIL) {
+        return FAIL;
+    }
+
+    int n = 0;
+    for (int from = dir_next_occupied(dir, 0); from < dir->capacity; from = dir_next_occupied(dir, from + 1)) {
+        int to = hashed ? dir_hash_free_slot(&slots, dir->hashes[from]) : n;
+        /* pooled names move with the slot, their references are kept */
+        slots.inumbers[to] = dir->inumbers[from];
+        slots.hashes[to] = dir->hashes[from];
+        slots.names[to] = dir->names[from];
+        slots.occupied[to / 64] |= (uint64_t) 1 << (to % 64);
+        n++;
+    }
+
+    dir_slots_free(dir);
+    dir->occupied = slots.occupied;
+    dir->inumbers = slots.inumbers;
+    dir->hashes = slots.hashes;
+    dir->names = slots.names;
+    dir->hashed = hashed;
+    dir->capacity = capacity;
+    dir->used = n;
+    return SUCCESS;
+}
+
+
+/*
+ * Creates an empty directory.
+ * Returns: the directory, or NULL if out of memory
+ */
+Directory *dir_create() {
+    Directory *dir = slab_alloc(sizeof(Directory));
+
+    if (dir == NULL) {
+        return NULL;
+    }
+    if (dir_slots_alloc(dir, DIR_INLINE_INITIAL) == FAIL) {
+        slab_free(dir, sizeof(Directory));
+        return NULL;
+    }
+    dir->hashed = 0;
+    dir->count = 0;
+    dir->used = 0;
+    return dir;
+}
+
+/*
+ * Releases a directory and its entries.
+ */
+void dir_destroy(Directory *dir) {
+    if (dir == NULL) {
+        return;
+    }
+    /* only the occupied slots are visited, deleting an empty directory
+     * does not depend on its capacity */
+    for (int i = dir_next_occupied(dir, 0); i < dir->capacity; i = dir_next_occupied(dir, i + 1)) {
+        dir_slot_clear(dir, i);
+    }
+    dir_slots_free(dir);
+    epoch_retire(dir, sizeof(Directory), slab_free);
+}
+
+/*
+ * Looks for an entry in a directory.
+ * Input:
+ *  - dir: directory
+ *  - name: name of the entry, not necessarily NUL terminated
+ *  - len: length of the name
+ *  - hash: hash of the name (see path.h)
+ * Returns:
+ *  inumber: i-number of the entry, if found
+ *     FAIL: otherwise
+ */
+int dir_lookup(Directory *dir, char *name, int len, unsigned int hash) {
+    int slot = dir_find_slot(dir, name, len, hash, NULL, 0);
+
+    return slot == FAIL ? FAIL : dir->inumbers[slot];
+}
+
+/*
+ * Looks for an entry in a directory without locking it. The directory may
+ * be changed meanwhile by a writer that holds seq odd (see seqlock.h);
+ * nothing read is used unless seq still holds start afterwards. Must be
+ * called inside an epoch critical section (see epoch.h), which keeps
+ * retired arrays and pooled names readable, with a dir pointer read after
+ * start and validated against it, so dir itself was not retired yet.
+ * Input:
+ *  - dir: directory
+ *  - name, len, hash: name of the entry, as in dir_lookup
+ *  - seq: sequence counter bumped by the writers of the directory
+ *  - start: value of seq read before dir
+ * Returns:
+ *    inumber: i-number of the entry, if found
+ *       FAIL: otherwise
+ *  DIR_RETRY: the directory changed, nothing can be concluded
+ */
+int dir_lookup_optimistic(Directory *dir, char *name, int len, unsigned int hash,
+                          unsigned int *seq, unsigned int start) {
+    /* capacity, layout and arrays must come from the same version */
+    Directory snapshot = *dir;
+
+    if (seq_read_retry(seq, start)) {
+        return DIR_RETRY;
+    }
+    int slot = dir_find_slot(&snapshot, name, len, hash, seq, start);
+    if (slot < 0) {
+        return slot;
+    }
+    int inumber = snapshot.inumbers[slot];
+    return seq_read_retry(seq, start) ? DIR_RETRY : inumber;
+}
+
+/*
+ * Adds an entry to a directory, growing it or switching it to a hash
+ * table when needed.
+ * Input:
+ *  - dir: directory
+ *  - name, len, hash: name of the entry, as in dir_lookup
+ *  - inumber: i-number of the entry
+ * Returns: SUCCESS or FAIL (entry already exists or out of memory)
+ */
+int dir_insert(Directory *dir, char *name, int len, unsigned int hash, int inumber) {
+    if (dir_find_slot(dir, name, len, hash, NULL, 0) != FAIL) {
+        return FAIL;
+    }
+
+    if (!dir->hashed) {
+        if (dir->count == dir->capacity) {
+            int hashed = dir->capacity == DIR_INLINE_MAX;
+            if (dir_rebuild(dir, hashed, hashed ? DIR_HASH_INITIAL : dir->capacity * 2) == FAIL) {
+                return FAIL;
+            }
+        }
+    }
+    /* keep the load factor, tombstones included, under 3/4 */
+    else if ((dir->used + 1) * 4 > dir->capacity * 3) {
+        int capacity = (dir->count + 1) * 2 > dir->capacity ? dir->capacity * 2 : dir->capacity;
+        if (dir_rebuild(dir, 1, capacity) == FAIL) {
+            return FAIL;
+        }
+    }
+
+    if (!dir->hashed) {
+        /* reuse the first free slot, so small directories keep their order;
+         * a flat array fits in the first bitmap word */
+        int slot = __builtin_ctzll(~dir->occupied[0]);
+        if (dir_slot_set(dir, slot, name, len, hash, inumber) == FAIL) {
+            return FAIL;
+        }
+        dir->count++;
+        return SUCCESS;
+    }
+
+    int slot = dir_hash_free_slot(dir, hash);
+    int was_free = dir->inumbers[slot] == FREE_INODE;
+    if (dir_slot_set(dir, slot, name, len, hash, inumber) == FAIL) {
+        return FAIL;
+    }
+    if (was_free) {
+        dir->used++;
+    }
+    dir->count++;
+    return SUCCESS;
+}
+
+/*
+ * Removes an entry from a directory.
+ * Input:
+ *  - dir: directory
+ *  - name, len, hash: name of the entry, as in dir_lookup
+ *  - inumber: i-number the entry must have
+ * Returns: SUCCESS or FAIL (not found)
+ */
+int dir_remove(Directory *dir, char *name, int len, unsigned int hash, int inumber) {
+    int slot = dir_find_slot(dir, name, len, hash, NULL, 0);
+
+    if (slot == FAIL || dir->inumbers[slot] != inumber) {
+        return FAIL;
+    }
+
+    dir_slot_clear(dir, slot);
+    dir->inumbers[slot] = dir->hashed ? DIR_TOMBSTONE : FREE_INODE;
+    dir->count--;
+
+    if (dir->hashed && dir->count <= DIR_SHRINK_COUNT) {
+        /* best effort, the hash table stays valid if this fails */
+        dir_rebuild(dir, 0, DIR_INLINE_MAX / 2);
+    }
+    return SUCCESS;
+}
+
+/*
+ * Checks if a directory has no entries.
+ * Returns: 1 if empty, 0 otherwise
+ */
+int dir_is_empty(Directory *dir) {
+    return dir->count == 0;
+}
+
+/*
+ * Iterates over the entries of a directory.
+ * Input:
+ *  - dir: directory
+ *  - cursor: iteration state, must start at 0
+ *  - name: buffer of MAX_FILE_NAME chars to store the entry name
+ * Returns:
+ *  inumber: i-number of the next entry
+ *     FAIL: when there are no more entries
+ */
+int dir_next_entry(Directory *dir, int *cursor, char *name) {
+    int slot = dir_next_occupied(dir, *cursor);
+
+    if (slot == dir->capacity) {
+        *cursor = slot;
+        return FAIL;
+    }
+    strcpy(name, dir_slot_name(&dir->names[slot]));
+    *cursor = slot + 1;
+    return dir->inumbers[slot];
+}
@@ -0,0 +1,156 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "dirscan.h"
+#include "state.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DIRSCAN_X86 1
+#endif
+
+
+/*
+ * Portable kernels, one slot at a time.
+ */
+static uint64_t scalar_match(const int *inumbers, const unsigned int *hashes, int n, unsigned int hash) {
+    uint64_t mask = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (hashes[i] == hash && inumbers[i] >= 0) {
+            mask |= (uint64_t) 1 << i;
+        }
+    }
+    return mask;
+}
+
+static uint64_t scalar_free(const int *inumbers, int n) {
+    uint64_t mask = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (inumbers[i] == FREE_INODE) {
+            mask |= (uint64_t) 1 << i;
+        }
+    }
+    return mask;
+}
+
+#ifdef DIRSCAN_X86
+
+/*
+ * SSE2 kernels, 4 slots per comparison. SSE2 is part of x86-64, so these
+ * need no runtime check there.
+ */
+__attribute__((target("sse2")))
+static uint64_t sse2_match(const int *inumbers, const unsigned int *hashes, int n, unsigned int hash) {
+    __m128i h = _mm_set1_epi32((int) hash);
+    __m128i minus1 = _mm_set1_epi32(-1);
+    uint64_t mask = 0;
+
+    for (int i = 0; i < n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (hashes + i)), h);
+        __m128i live = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *) (inumbers + i)), minus1);
+        mask |= (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(eq, live))) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("sse2")))
+static uint64_t sse2_free(const int *inumbers, int n) {
+    __m128i free = _mm_set1_epi32(FREE_INODE);
+    uint64_t mask = 0;
+
+    for (int i = 0; i < n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (inumbers + i)), free);
+        mask |= (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(eq)) << i;
+    }
+    return mask;
+}
+
+/*
+ * AVX2 kernels, 8 slots per comparison.
+ */
+__attribute__((target("avx2")))
+static uint64_t avx2_match(const int *inumbers, const unsigned int *hashes, int n, unsigned int hash) {
+    __m256i h = _mm256_set1_epi32((int) hash);
+    __m256i minus1 = _mm256_set1_epi32(-1);
+    uint64_t mask = 0;
+
+    for (int i = 0; i < n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (hashes + i)), h);
+        __m256i live = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *) (inumbers + i)), minus1);
+        mask |= (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(eq, live))) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2_free(const int *inumbers, int n) {
+    __m256i free = _mm256_set1_epi32(FREE_INODE);
+    uint64_t mask = 0;
+
+    for (int i = 0; i < n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (inumbers + i)), free);
+        mask |= (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(eq)) << i;
+    }
+    return mask;
+}
+
+#endif /* DIRSCAN_X86 */
+
+
+static DirScanOps kernels[] = {
+    { "scalar", scalar_match, scalar_free },
+#ifdef DIRSCAN_X86
+    { "sse2", sse2_match, sse2_free },
+    { "avx2", avx2_match, avx2_free },
+#endif
+};
+
+DirScanOps dirscan = { "scalar", scalar_match, scalar_free };
+
+
+/*
+ * Checks if the CPU can run a set of kernels.
+ */
+static int dirscan_supported(const char *name) {
+#ifdef DIRSCAN_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (strcmp(name, "sse2") == 0) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+/*
+ * Selects a set of kernels by name.
+ * Returns: SUCCESS, or FAIL if unknown or not supported by this CPU
+ */
+int dirscan_select(const char *name) {
+    for (int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (strcmp(kernels[i].name, name) == 0 && dirscan_supported(name)) {
+            dirscan = kernels[i];
+            return SUCCESS;
+        }
+    }
+    return FAIL;
+}
+
+/*
+ * Selects the widest kernels the CPU supports, unless TECNICOFS_SCAN
+ * names others.
+ */
+void dirscan_init() {
+    const char *forced = getenv("TECNICOFS_SCAN");
+
+    if (forced != NULL && dirscan_select(forced) == SUCCESS) {
+        return;
+    }
+    if (dirscan_select("avx2") == FAIL && dirscan_select("sse2") == FAIL) {
+        dirscan_select("scalar");
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef DIRSCAN_H
+#define DIRSCAN_H
+
+#include <stdint.h>
+
+/*
+ * Scan kernels over the slot arrays of a directory. Each kernel looks at n
+ * slots (a multiple of DIRSCAN_GROUP, at most 64) and returns a bitmask
+ * with bit i set when slot i satisfies the test. The implementation is
+ * picked at startup: AVX2 (8 slots per instruction), SSE2 (4 slots) or a
+ * scalar fallback. TECNICOFS_SCAN=scalar|sse2|avx2 forces one of them.
+ */
+#define DIRSCAN_GROUP 8
+
+typedef struct dirScanOps {
+	const char *name;
+	/* live slots whose fingerprint equals hash */
+	uint64_t (*match)(const int *inumbers, const unsigned int *hashes, int n, unsigned int hash);
+	/* slots that are free (never used since the last rebuild) */
+	uint64_t (*free)(const int *inumbers, int n);
+} DirScanOps;
+
+extern DirScanOps dirscan;
+
+void dirscan_init();
+int dirscan_select(const char *name);
+
+#endif /* DIRSCAN_H */
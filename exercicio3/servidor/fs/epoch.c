@@ -0,0 +1,319 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "epoch.h"
+#include "state.h"
+
+
+/* limbo lists kept by each thread, one per epoch that may still be read */
+#define EPOCH_LIMBOS 3
+
+typedef struct epochRetired {
+    void *ptr;
+    size_t size;
+    EpochRelease release;
+} EpochRetired;
+
+/* memory retired by one thread in one epoch */
+typedef struct epochBag {
+    struct epochBag *next;
+    unsigned long epoch;
+    int count;
+    EpochRetired items[EPOCH_BAG_SIZE];
+} EpochBag;
+
+typedef struct epochThread {
+    struct epochThread *next;   /* registry link, records are never unlinked */
+    unsigned long announced;    /* epoch << 1 | 1 inside a critical section, 0 outside */
+    int in_use;                 /* 0 once its thread exited, so it can be reused */
+    int nesting;
+    int pending;                /* retires since the last collection */
+    EpochBag *limbo[EPOCH_LIMBOS];
+    EpochBag *spare;
+} __attribute__((aligned(64))) EpochThread;
+
+/* starts at 1, so an announcement is never 0 */
+static unsigned long global_epoch = 1;
+static EpochThread *threads = NULL;
+
+/* limbo lists of threads that exited */
+static EpochBag *orphans = NULL;
+static pthread_mutex_t orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long retired = 0;
+static unsigned long reclaimed = 0;
+
+static __thread EpochThread *self = NULL;
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Releases the memory in a list of bags, keeping one bag as the spare of
+ * a thread (if given) and freeing the others.
+ */
+static void epoch_release_bags(EpochBag *bag, EpochThread *thread) {
+    while (bag != NULL) {
+        EpochBag *next = bag->next;
+        for (int i = 0; i < bag->count; i++) {
+            bag->items[i].release(bag->items[i].ptr, bag->items[i].size);
+        }
+        __atomic_add_fetch(&reclaimed, bag->count, __ATOMIC_RELAXED);
+        if (thread != NULL && thread->spare == NULL) {
+            thread->spare = bag;
+        }
+        else {
+            free(bag);
+        }
+        bag = next;
+    }
+}
+
+/*
+ * Hands the limbo lists of an exiting thread over to the orphan list and
+ * frees its record for reuse.
+ */
+static void epoch_thread_exit(void *arg) {
+    EpochThread *thread = arg;
+
+    __atomic_store_n(&thread->announced, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&orphan_lock);
+    for (int l = 0; l < EPOCH_LIMBOS; l++) {
+        while (thread->limbo[l] != NULL) {
+            EpochBag *bag = thread->limbo[l];
+            thread->limbo[l] = bag->next;
+            bag->next = orphans;
+            orphans = bag;
+        }
+    }
+    pthread_mutex_unlock(&orphan_lock);
+    free(thread->spare);
+    thread->spare = NULL;
+    thread->nesting = 0;
+    thread->pending = 0;
+    __atomic_store_n(&thread->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void epoch_create_key() {
+    if (pthread_key_create(&epoch_key, epoch_thread_exit) != 0) {
+        perror("Error: Cannot create epoch key.");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Returns the record of the calling thread, registering the thread on
+ * its first call. Records of exited threads are reused.
+ */
+static EpochThread *epoch_self() {
+    if (self != NULL) {
+        return self;
+    }
+    pthread_once(&epoch_key_once, epoch_create_key);
+
+    EpochThread *thread;
+    for (thread = __atomic_load_n(&threads, __ATOMIC_ACQUIRE); thread != NULL; thread = thread->next) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&thread->in_use, &unused, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (thread == NULL) {
+        if (posix_memalign((void **) &thread, 64, sizeof(EpochThread)) != 0) {
+            perror("Error: Cannot register thread for epochs.");
+            exit(EXIT_FAILURE);
+        }
+        memset(thread, 0, sizeof(EpochThread));
+        thread->in_use = 1;
+        thread->next = __atomic_load_n(&threads, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&threads, &thread->next, thread, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_setspecific(epoch_key, thread);
+    self = thread;
+    return thread;
+}
+
+/*
+ * Advances the global epoch if every thread inside a critical section
+ * has announced the current one.
+ * Returns: the global epoch
+ */
+static unsigned long epoch_try_advance() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+
+    for (EpochThread *thread = __atomic_load_n(&threads, __ATOMIC_ACQUIRE); thread != NULL;
+         thread = thread->next) {
+        unsigned long announced = __atomic_load_n(&thread->announced, __ATOMIC_ACQUIRE);
+        if ((announced & 1) && (announced >> 1) != epoch) {
+            return epoch;
+        }
+    }
+    if (__atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return epoch + 1;
+    }
+    /* another thread advanced it, epoch holds the new value */
+    return epoch;
+}
+
+/*
+ * Tries to advance the epoch, then releases the limbo lists of a thread,
+ * and the orphaned ones, that no reader can still reach.
+ */
+static void epoch_collect(EpochThread *thread) {
+    unsigned long epoch = epoch_try_advance();
+
+    for (int l = 0; l < EPOCH_LIMBOS; l++) {
+        if (thread->limbo[l] != NULL && thread->limbo[l]->epoch + 2 <= epoch) {
+            epoch_release_bags(thread->limbo[l], thread);
+            thread->limbo[l] = NULL;
+        }
+    }
+    if (__atomic_load_n(&orphans, __ATOMIC_RELAXED) != NULL &&
+        pthread_mutex_trylock(&orphan_lock) == 0) {
+        EpochBag **link = &orphans;
+        while (*link != NULL) {
+            EpochBag *bag = *link;
+            if (bag->epoch + 2 <= epoch) {
+                *link = bag->next;
+                bag->next = NULL;
+                epoch_release_bags(bag, NULL);
+            }
+            else {
+                link = &bag->next;
+            }
+        }
+        pthread_mutex_unlock(&orphan_lock);
+    }
+    thread->pending = 0;
+}
+
+
+/*
+ * Initializes the epochs, with nothing retired.
+ */
+void epoch_init() {
+    global_epoch = 1;
+    threads = NULL;
+    orphans = NULL;
+    retired = 0;
+    reclaimed = 0;
+}
+
+/*
+ * Releases all retired memory and the thread records.
+ * Must be called once no other thread uses the epochs.
+ */
+void epoch_destroy() {
+    EpochThread *thread = threads;
+
+    while (thread != NULL) {
+        EpochThread *next = thread->next;
+        for (int l = 0; l < EPOCH_LIMBOS; l++) {
+            epoch_release_bags(thread->limbo[l], NULL);
+        }
+        free(thread->spare);
+        free(thread);
+        thread = next;
+    }
+    epoch_release_bags(orphans, NULL);
+    threads = NULL;
+    orphans = NULL;
+    if (self != NULL) {
+        pthread_setspecific(epoch_key, NULL);
+        self = NULL;
+    }
+}
+
+/*
+ * Starts a critical section: memory retired from now on is not released
+ * until the matching epoch_exit. Critical sections may be nested.
+ */
+void epoch_enter() {
+    EpochThread *thread = epoch_self();
+
+    if (thread->nesting++ > 0) {
+        return;
+    }
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    for (;;) {
+        __atomic_store_n(&thread->announced, epoch << 1 | 1, __ATOMIC_RELAXED);
+        /* the announcement must be visible before anything is read */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        unsigned long now = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+        if (now == epoch) {
+            break;
+        }
+        epoch = now;
+    }
+}
+
+/*
+ * Ends a critical section started by epoch_enter.
+ */
+void epoch_exit() {
+    EpochThread *thread = self;
+
+    if (--thread->nesting > 0) {
+        return;
+    }
+    __atomic_store_n(&thread->announced, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Releases memory once no reader can still reach it. Must be called
+ * after the memory is unlinked from everything a reader may follow.
+ * Input:
+ *  - ptr: memory to release, or NULL
+ *  - size: size handed to release
+ *  - release: function that releases the memory
+ */
+void epoch_retire(void *ptr, size_t size, EpochRelease release) {
+    if (ptr == NULL) {
+        return;
+    }
+    EpochThread *thread = epoch_self();
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    EpochBag **limbo = &thread->limbo[epoch % EPOCH_LIMBOS];
+
+    /* a list left from epoch - 3 or earlier is no longer reachable */
+    if (*limbo != NULL && (*limbo)->epoch != epoch) {
+        epoch_release_bags(*limbo, thread);
+        *limbo = NULL;
+    }
+    if (*limbo == NULL || (*limbo)->count == EPOCH_BAG_SIZE) {
+        EpochBag *bag = thread->spare;
+        thread->spare = NULL;
+        if (bag == NULL && (bag = malloc(sizeof(EpochBag))) == NULL) {
+            perror("Error: Cannot retire memory.");
+            exit(EXIT_FAILURE);
+        }
+        bag->epoch = epoch;
+        bag->count = 0;
+        bag->next = *limbo;
+        *limbo = bag;
+    }
+    EpochRetired *item = &(*limbo)->items[(*limbo)->count++];
+    item->ptr = ptr;
+    item->size = size;
+    item->release = release;
+    __atomic_add_fetch(&retired, 1, __ATOMIC_RELAXED);
+
+    if (++thread->pending >= EPOCH_BATCH) {
+        epoch_collect(thread);
+    }
+}
+
+void epoch_print_stats(FILE *fp) {
+    fprintf(fp, "epoch: %lu retired, %lu reclaimed, epoch %lu\n",
+            __atomic_load_n(&retired, __ATOMIC_RELAXED),
+            __atomic_load_n(&reclaimed, __ATOMIC_RELAXED),
+            __atomic_load_n(&global_epoch, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,33 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Epoch-based reclamation for memory read without locks.
+ * A reader brackets its lock-free accesses with epoch_enter and
+ * epoch_exit, announcing the global epoch it started in. Memory unlinked
+ * by a writer is handed to epoch_retire instead of being released, and is
+ * kept in a per-thread limbo list of the epoch it was retired in. The
+ * global epoch only advances once every thread inside a critical section
+ * has announced the current one, so memory retired in epoch e is released
+ * once the global epoch reaches e + 2. Limbo lists are released in
+ * batches, after EPOCH_BATCH retires by the same thread.
+ */
+#define EPOCH_BATCH 64
+#define EPOCH_BAG_SIZE 64
+
+
+/* releases retired memory, with the size it was retired with */
+typedef void (*EpochRelease)(void *ptr, size_t size);
+
+
+void epoch_init();
+void epoch_destroy();
+void epoch_enter();
+void epoch_exit();
+void epoch_retire(void *ptr, size_t size, EpochRelease release);
+void epoch_print_stats(FILE *fp);
+
+#endif /* EPOCH_H */
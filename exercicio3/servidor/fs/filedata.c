@@ -0,0 +1,232 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "filedata.h"
+#include "slab.h"
+#include "state.h"
+
+
+/* read in place of the holes of a file */
+static char zero_page[FILE_PAGE_SIZE];
+
+
+static size_t file_page_count(size_t size) {
+    return (size + FILE_PAGE_SIZE - 1) >> FILE_PAGE_SHIFT;
+}
+
+static void file_free_pages(FileData *file, size_t first) {
+    for (size_t p = first; p < file->npages; p++) {
+        if (file->u.pages[p] != NULL) {
+            slab_free(file->u.pages[p], FILE_PAGE_SIZE);
+            file->u.pages[p] = NULL;
+        }
+    }
+}
+
+/*
+ * Grows the page table so it has at least n slots, doubling its size.
+ * Contents that are still inline move to the first page.
+ * Returns: SUCCESS or FAIL (out of memory)
+ */
+static int file_reserve(FileData *file, size_t n) {
+    if (file->paged && n <= file->npages) {
+        return SUCCESS;
+    }
+
+    size_t npages = file->paged ? file->npages : FILE_TABLE_INITIAL;
+    while (npages < n) {
+        npages *= 2;
+    }
+    if (npages > INT_MAX) {
+        return FAIL;
+    }
+    char **pages = slab_alloc(npages * sizeof(char *));
+    if (pages == NULL) {
+        return FAIL;
+    }
+
+    if (file->paged) {
+        memcpy(pages, file->u.pages, file->npages * sizeof(char *));
+        memset(pages + file->npages, 0, (npages - file->npages) * sizeof(char *));
+        slab_free(file->u.pages, file->npages * sizeof(char *));
+    }
+    else {
+        memset(pages, 0, npages * sizeof(char *));
+        if (file->size > 0) {
+            pages[0] = slab_alloc(FILE_PAGE_SIZE);
+            if (pages[0] == NULL) {
+                slab_free(pages, npages * sizeof(char *));
+                return FAIL;
+            }
+            memcpy(pages[0], file->u.bytes, FILE_INLINE_SIZE);
+            memset(pages[0] + FILE_INLINE_SIZE, 0, FILE_PAGE_SIZE - FILE_INLINE_SIZE);
+        }
+        file->paged = 1;
+    }
+    file->u.pages = pages;
+    file->npages = npages;
+    return SUCCESS;
+}
+
+
+/*
+ * Initializes the contents of a new, empty file.
+ */
+void file_init(FileData *file) {
+    file->size = 0;
+    file->paged = 0;
+    file->npages = 0;
+    memset(file->u.bytes, 0, FILE_INLINE_SIZE);
+}
+
+/*
+ * Releases the contents of a file, leaving it empty.
+ */
+void file_destroy(FileData *file) {
+    if (file->paged) {
+        file_free_pages(file, 0);
+        slab_free(file->u.pages, file->npages * sizeof(char *));
+    }
+    file_init(file);
+}
+
+/*
+ * Writes to a file at an offset, growing it if needed. Writing past the
+ * end leaves a hole between the old end and the offset.
+ * Input:
+ *  - file: the file
+ *  - buf: bytes to write
+ *  - len: number of bytes, at most INT_MAX
+ *  - offset: position in the file
+ * Returns: number of bytes written, or FAIL
+ */
+int file_write(FileData *file, char *buf, size_t len, size_t offset) {
+    size_t end = offset + len;
+
+    if (len > INT_MAX || end < offset) {
+        return FAIL;
+    }
+    if (len == 0) {
+        return 0;
+    }
+
+    if (!file->paged && end <= FILE_INLINE_SIZE) {
+        memcpy(file->u.bytes + offset, buf, len);
+    }
+    else {
+        if (file_reserve(file, file_page_count(end)) == FAIL) {
+            return FAIL;
+        }
+        size_t done = 0;
+        while (done < len) {
+            size_t pos = offset + done;
+            size_t in_page = pos & (FILE_PAGE_SIZE - 1);
+            size_t n = FILE_PAGE_SIZE - in_page < len - done ? FILE_PAGE_SIZE - in_page : len - done;
+            char **page = &file->u.pages[pos >> FILE_PAGE_SHIFT];
+
+            if (*page == NULL) {
+                *page = slab_alloc(FILE_PAGE_SIZE);
+                if (*page == NULL) {
+                    /* keep what was written */
+                    break;
+                }
+                if (n < FILE_PAGE_SIZE) {
+                    memset(*page, 0, FILE_PAGE_SIZE);
+                }
+            }
+            memcpy(*page + in_page, buf + done, n);
+            done += n;
+        }
+        if (done == 0) {
+            return FAIL;
+        }
+        len = done;
+        end = offset + done;
+    }
+
+    if (end > file->size) {
+        file->size = end;
+    }
+    return (int) len;
+}
+
+/*
+ * Reads from a file at an offset.
+ * Input:
+ *  - file: the file
+ *  - buf: buffer of at least len bytes
+ *  - len: number of bytes, at most INT_MAX
+ *  - offset: position in the file
+ * Returns: number of bytes read, 0 at or past the end, or FAIL
+ */
+int file_read(FileData *file, char *buf, size_t len, size_t offset) {
+    if (len > INT_MAX) {
+        return FAIL;
+    }
+    if (offset >= file->size) {
+        return 0;
+    }
+    if (len > file->size - offset) {
+        len = file->size - offset;
+    }
+
+    if (!file->paged) {
+        memcpy(buf, file->u.bytes + offset, len);
+        return (int) len;
+    }
+    for (size_t done = 0; done < len; ) {
+        size_t pos = offset + done;
+        size_t in_page = pos & (FILE_PAGE_SIZE - 1);
+        size_t n = FILE_PAGE_SIZE - in_page < len - done ? FILE_PAGE_SIZE - in_page : len - done;
+        char *page = file->u.pages[pos >> FILE_PAGE_SHIFT];
+
+        memcpy(buf + done, (page != NULL ? page : zero_page) + in_page, n);
+        done += n;
+    }
+    return (int) len;
+}
+
+/*
+ * Describes a range of a file as buffers pointing into its pages, so it
+ * can be sent (e.g. with writev) without copying it first. The buffers
+ * are only valid while the i-node lock is held and the file unchanged.
+ * Input:
+ *  - file: the file
+ *  - offset: position in the file
+ *  - len: number of bytes wanted
+ *  - iov: array to fill
+ *  - iovcnt: number of entries of iov
+ * Returns: number of entries filled; they may cover less than len bytes
+ *  when the range ends past the file or needs more than iovcnt entries
+ */
+int file_read_iov(FileData *file, size_t offset, size_t len, struct iovec *iov, int iovcnt) {
+    if (offset >= file->size) {
+        return 0;
+    }
+    if (len > file->size - offset) {
+        len = file->size - offset;
+    }
+
+    if (!file->paged) {
+        if (iovcnt == 0) {
+            return 0;
+        }
+        iov[0].iov_base = file->u.bytes + offset;
+        iov[0].iov_len = len;
+        return 1;
+    }
+
+    int n = 0;
+    for (size_t done = 0; done < len && n < iovcnt; n++) {
+        size_t pos = offset + done;
+        size_t in_page = pos & (FILE_PAGE_SIZE - 1);
+        size_t chunk = FILE_PAGE_SIZE - in_page < len - done ? FILE_PAGE_SIZE - in_page : len - done;
+        char *page = file->u.pages[pos >> FILE_PAGE_SHIFT];
+
+        iov[n].iov_base = (page != NULL ? page : zero_page) + in_page;
+        iov[n].iov_len = chunk;
+        done += chunk;
+    }
+    return n;
+}
@@ -0,0 +1,411 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "lockprof.h"
+#include "state.h"
+
+
+#define LOCKPROF_UNUSED INT_MIN
+#define LOCKPROF_INITIAL 256
+
+typedef struct lockprofEntry {
+    int id;                     /* LOCKPROF_UNUSED while the entry is free */
+    unsigned long acquired;
+    unsigned long contended;    /* acquisitions that had to wait */
+    unsigned long wait_ns;
+    unsigned long max_wait_ns;
+    unsigned long hold_ns;
+    unsigned long held_since;   /* while held by the thread, 0 otherwise */
+    unsigned long waits[LOCKPROF_BUCKETS];
+} LockprofEntry;
+
+/* counters of one thread, an open-addressing table keyed by lock id */
+typedef struct lockprofTable {
+    struct lockprofTable *next;
+    pthread_mutex_t resize_lock;    /* only taken to grow, and by reports */
+    int capacity;
+    int count;
+    LockprofEntry *entries;
+} LockprofTable;
+
+int lockprof_enabled = 0;
+static int report_top = LOCKPROF_DEFAULT_TOP;
+
+/* tables of every thread that took a lock, kept after the thread exits */
+static LockprofTable *tables = NULL;
+static pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread LockprofTable *self = NULL;
+
+static const char *global_names[LOCKPROF_GLOBALS] = { "tree lock", "inode alloc lock" };
+
+
+static unsigned long lockprof_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static LockprofEntry *lockprof_alloc_entries(int capacity) {
+    LockprofEntry *entries = calloc(capacity, sizeof(LockprofEntry));
+
+    if (entries == NULL) {
+        perror("Error: Cannot allocate lock profile.");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < capacity; i++) {
+        entries[i].id = LOCKPROF_UNUSED;
+    }
+    return entries;
+}
+
+/*
+ * Returns the entry of a lock in a table, adding it if insert is set.
+ * The table must have a free entry.
+ */
+static LockprofEntry *lockprof_find(LockprofEntry *entries, int capacity, int id, int insert) {
+    unsigned int i = ((unsigned int) id * 2654435761u) & (capacity - 1);
+
+    while (entries[i].id != id) {
+        if (entries[i].id == LOCKPROF_UNUSED) {
+            if (!insert) {
+                return NULL;
+            }
+            entries[i].id = id;
+            return &entries[i];
+        }
+        i = (i + 1) & (capacity - 1);
+    }
+    return &entries[i];
+}
+
+/*
+ * Doubles the table of the calling thread.
+ */
+static void lockprof_grow(LockprofTable *table) {
+    int capacity = table->capacity * 2;
+    LockprofEntry *entries = lockprof_alloc_entries(capacity);
+
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->entries[i].id != LOCKPROF_UNUSED) {
+            *lockprof_find(entries, capacity, table->entries[i].id, 1) = table->entries[i];
+        }
+    }
+    pthread_mutex_lock(&table->resize_lock);
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+    pthread_mutex_unlock(&table->resize_lock);
+}
+
+/*
+ * Returns the entry of a lock in the table of the calling thread,
+ * registering the thread on its first call.
+ */
+static LockprofEntry *lockprof_entry(int id) {
+    LockprofTable *table = self;
+
+    if (table == NULL) {
+        table = malloc(sizeof(LockprofTable));
+        if (table == NULL) {
+            perror("Error: Cannot allocate lock profile.");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_init(&table->resize_lock, NULL);
+        table->capacity = LOCKPROF_INITIAL;
+        table->count = 0;
+        table->entries = lockprof_alloc_entries(LOCKPROF_INITIAL);
+        pthread_mutex_lock(&tables_lock);
+        table->next = tables;
+        tables = table;
+        pthread_mutex_unlock(&tables_lock);
+        self = table;
+    }
+
+    LockprofEntry *entry = lockprof_find(table->entries, table->capacity, id, 0);
+    if (entry == NULL) {
+        if ((table->count + 1) * 4 > table->capacity * 3) {
+            lockprof_grow(table);
+        }
+        entry = lockprof_find(table->entries, table->capacity, id, 1);
+        table->count++;
+    }
+    return entry;
+}
+
+/*
+ * Counts an acquisition that started at start.
+ */
+static void lockprof_acquired(int id, int contended, unsigned long start) {
+    unsigned long now = lockprof_now();
+    LockprofEntry *entry = lockprof_entry(id);
+
+    entry->acquired++;
+    if (contended) {
+        unsigned long wait = now - start;
+        unsigned long us = wait / 1000;
+        int bucket = us == 0 ? 0 : (int) (sizeof(unsigned long) * 8 - __builtin_clzl(us));
+
+        entry->contended++;
+        entry->wait_ns += wait;
+        if (wait > entry->max_wait_ns) {
+            entry->max_wait_ns = wait;
+        }
+        entry->waits[bucket < LOCKPROF_BUCKETS ? bucket : LOCKPROF_BUCKETS - 1]++;
+    }
+    entry->held_since = now;
+}
+
+static void lockprof_released(int id) {
+    LockprofEntry *entry = lockprof_entry(id);
+
+    if (entry->held_since != 0) {
+        entry->hold_ns += lockprof_now() - entry->held_since;
+        entry->held_since = 0;
+    }
+}
+
+static int lockprof_compare(const void *a, const void *b) {
+    const LockprofEntry *x = a, *y = b;
+
+    if (x->wait_ns != y->wait_ns) {
+        return x->wait_ns < y->wait_ns ? 1 : -1;
+    }
+    if (x->acquired != y->acquired) {
+        return x->acquired < y->acquired ? 1 : -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Enables the profiler if TECNICOFS_LOCKPROF is set, and not 0.
+ */
+void lockprof_init() {
+    char *env = getenv("TECNICOFS_LOCKPROF");
+
+    lockprof_enabled = env != NULL && strcmp(env, "0") != 0;
+    report_top = env != NULL && atoi(env) > 0 ? atoi(env) : LOCKPROF_DEFAULT_TOP;
+}
+
+/*
+ * Releases the counters of every thread.
+ * Must be called once no other thread takes locks.
+ */
+void lockprof_destroy() {
+    pthread_mutex_lock(&tables_lock);
+    while (tables != NULL) {
+        LockprofTable *next = tables->next;
+        pthread_mutex_destroy(&tables->resize_lock);
+        free(tables->entries);
+        free(tables);
+        tables = next;
+    }
+    pthread_mutex_unlock(&tables_lock);
+    self = NULL;
+    lockprof_enabled = 0;
+}
+
+/*
+ * Lock wrappers: each takes the lock like the bravo or pthread function
+ * it is named after, and returns what that function returned. A lock that is
+ * busy is first tried, so the acquisition is counted as contended.
+ * Input:
+ *  - lock: the lock
+ *  - id: i-number of the i-node of the lock, or one of the LOCKPROF ids
+ */
+int lockprof_rdlock(BravoLock *lock, int id) {
+    if (!lockprof_enabled) {
+        return bravo_rdlock(lock);
+    }
+    unsigned long start = lockprof_now();
+    int contended = 0, err = bravo_tryrdlock(lock);
+    if (err == EBUSY) {
+        contended = 1;
+        err = bravo_rdlock(lock);
+    }
+    if (err == 0) {
+        lockprof_acquired(id, contended, start);
+    }
+    return err;
+}
+
+int lockprof_wrlock(BravoLock *lock, int id) {
+    if (!lockprof_enabled) {
+        return bravo_wrlock(lock);
+    }
+    unsigned long start = lockprof_now();
+    int contended = 0, err = bravo_trywrlock(lock);
+    if (err == EBUSY) {
+        contended = 1;
+        err = bravo_wrlock(lock);
+    }
+    if (err == 0) {
+        lockprof_acquired(id, contended, start);
+    }
+    return err;
+}
+
+int lockprof_tryrdlock(BravoLock *lock, int id) {
+    int err = bravo_tryrdlock(lock);
+
+    if (err == 0 && lockprof_enabled) {
+        lockprof_acquired(id, 0, 0);
+    }
+    return err;
+}
+
+int lockprof_trywrlock(BravoLock *lock, int id) {
+    int err = bravo_trywrlock(lock);
+
+    if (err == 0 && lockprof_enabled) {
+        lockprof_acquired(id, 0, 0);
+    }
+    return err;
+}
+
+int lockprof_rwunlock(BravoLock *lock, int id) {
+    if (lockprof_enabled) {
+        lockprof_released(id);
+    }
+    return bravo_unlock(lock);
+}
+
+int lockprof_mutex_lock(pthread_mutex_t *lock, int id) {
+    if (!lockprof_enabled) {
+        return pthread_mutex_lock(lock);
+    }
+    unsigned long start = lockprof_now();
+    int contended = 0, err = pthread_mutex_trylock(lock);
+    if (err == EBUSY) {
+        contended = 1;
+        err = pthread_mutex_lock(lock);
+    }
+    if (err == 0) {
+        lockprof_acquired(id, contended, start);
+    }
+    return err;
+}
+
+int lockprof_mutex_unlock(pthread_mutex_t *lock, int id) {
+    if (lockprof_enabled) {
+        lockprof_released(id);
+    }
+    return pthread_mutex_unlock(lock);
+}
+
+/*
+ * Merges the counters of all threads and prints the locks waited on the
+ * longest, with the histogram of their waits. Counters of threads still
+ * running may miss their last few updates.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void lockprof_report(FILE *fp) {
+    if (!lockprof_enabled) {
+        return;
+    }
+
+    int capacity = LOCKPROF_INITIAL;
+    LockprofEntry *merged = lockprof_alloc_entries(capacity);
+    int count = 0;
+
+    pthread_mutex_lock(&tables_lock);
+    for (LockprofTable *table = tables; table != NULL; table = table->next) {
+        pthread_mutex_lock(&table->resize_lock);
+        for (int i = 0; i < table->capacity; i++) {
+            LockprofEntry *entry = &table->entries[i];
+            if (entry->id == LOCKPROF_UNUSED) {
+                continue;
+            }
+            if ((count + 1) * 2 > capacity) {
+                LockprofEntry *old = merged;
+                merged = lockprof_alloc_entries(capacity * 2);
+                for (int j = 0; j < capacity; j++) {
+                    if (old[j].id != LOCKPROF_UNUSED) {
+                        *lockprof_find(merged, capacity * 2, old[j].id, 1) = old[j];
+                    }
+                }
+                free(old);
+                capacity *= 2;
+            }
+            LockprofEntry *sum = lockprof_find(merged, capacity, entry->id, 0);
+            if (sum == NULL) {
+                sum = lockprof_find(merged, capacity, entry->id, 1);
+                count++;
+            }
+            sum->acquired += entry->acquired;
+            sum->contended += entry->contended;
+            sum->wait_ns += entry->wait_ns;
+            sum->hold_ns += entry->hold_ns;
+            if (entry->max_wait_ns > sum->max_wait_ns) {
+                sum->max_wait_ns = entry->max_wait_ns;
+            }
+            for (int b = 0; b < LOCKPROF_BUCKETS; b++) {
+                sum->waits[b] += entry->waits[b];
+            }
+        }
+        pthread_mutex_unlock(&table->resize_lock);
+    }
+    pthread_mutex_unlock(&tables_lock);
+
+    /* move the used entries to the front, then sort them */
+    unsigned long acquired = 0, contended = 0, wait_ns = 0;
+    int n = 0;
+    for (int i = 0; i < capacity; i++) {
+        if (merged[i].id != LOCKPROF_UNUSED) {
+            acquired += merged[i].acquired;
+            contended += merged[i].contended;
+            wait_ns += merged[i].wait_ns;
+            merged[n++] = merged[i];
+        }
+    }
+    qsort(merged, n, sizeof(LockprofEntry), lockprof_compare);
+
+    fprintf(fp, "lockprof: %d locks, %lu acquisitions, %lu contended, %.3f ms waited\n",
+            n, acquired, contended, wait_ns / 1e6);
+    fprintf(fp, "%-18s %12s %10s %12s %12s %12s\n",
+            "lock", "acquired", "contended", "wait us", "max wait us", "hold us");
+    for (int i = 0; i < n && i < report_top; i++) {
+        LockprofEntry *entry = &merged[i];
+        char name[32];
+
+        if (entry->id < 0 && -entry->id <= LOCKPROF_GLOBALS) {
+            snprintf(name, sizeof(name), "%s", global_names[-entry->id - 1]);
+        }
+        else if (entry->id == FS_ROOT) {
+            snprintf(name, sizeof(name), "inode %d (root)", entry->id);
+        }
+        else {
+            snprintf(name, sizeof(name), "inode %d", entry->id);
+        }
+        fprintf(fp, "%-18s %12lu %10lu %12.1f %12.1f %12.1f\n", name, entry->acquired,
+                entry->contended, entry->wait_ns / 1e3, entry->max_wait_ns / 1e3,
+                entry->hold_ns / 1e3);
+
+        if (entry->contended > 0) {
+            fprintf(fp, "%-18s", "  waits");
+            for (int b = 0; b < LOCKPROF_BUCKETS; b++) {
+                if (entry->waits[b] == 0) {
+                    continue;
+                }
+                if (b == 0) {
+                    fprintf(fp, " <1us:%lu", entry->waits[b]);
+                }
+                else if (b == LOCKPROF_BUCKETS - 1) {
+                    fprintf(fp, " >=%luus:%lu", 1UL << (b - 1), entry->waits[b]);
+                }
+                else {
+                    fprintf(fp, " %lu-%luus:%lu", 1UL << (b - 1), 1UL << b, entry->waits[b]);
+                }
+            }
+            fprintf(fp, "\n");
+        }
+    }
+    free(merged);
+}
@@ -0,0 +1,162 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "namepool.h"
+#include "slab.h"
+#include "epoch.h"
+
+
+typedef struct pooledName {
+    struct pooledName *next;
+    unsigned int hash;
+    int refs;
+    int len;
+    char chars[];
+} PooledName;
+
+/* chained hash table of interned names, protected by pool_lock */
+static PooledName **buckets = NULL;
+static int nbuckets = 0;
+static int nnames = 0;
+static size_t nbytes = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static size_t namepool_entry_size(int len) {
+    return sizeof(PooledName) + len + 1;
+}
+
+/*
+ * Doubles the number of buckets. Must be called with pool_lock held.
+ */
+static void namepool_grow() {
+    int n = nbuckets * 2;
+    PooledName **table = calloc(n, sizeof(PooledName *));
+
+    if (table == NULL) {
+        /* chains just get longer */
+        return;
+    }
+    for (int b = 0; b < nbuckets; b++) {
+        PooledName *entry = buckets[b];
+        while (entry != NULL) {
+            PooledName *next = entry->next;
+            entry->next = table[entry->hash & (n - 1)];
+            table[entry->hash & (n - 1)] = entry;
+            entry = next;
+        }
+    }
+    free(buckets);
+    buckets = table;
+    nbuckets = n;
+}
+
+
+/*
+ * Initializes the name pool.
+ */
+void namepool_init() {
+    buckets = calloc(NAMEPOOL_INITIAL_BUCKETS, sizeof(PooledName *));
+    if (buckets == NULL) {
+        perror("Error: Cannot allocate name pool.");
+        exit(EXIT_FAILURE);
+    }
+    nbuckets = NAMEPOOL_INITIAL_BUCKETS;
+    nnames = 0;
+    nbytes = 0;
+}
+
+/*
+ * Releases the name pool and every name still in it.
+ */
+void namepool_destroy() {
+    for (int b = 0; b < nbuckets; b++) {
+        PooledName *entry = buckets[b];
+        while (entry != NULL) {
+            PooledName *next = entry->next;
+            slab_free(entry, namepool_entry_size(entry->len));
+            entry = next;
+        }
+    }
+    free(buckets);
+    buckets = NULL;
+    nbuckets = 0;
+    nnames = 0;
+    nbytes = 0;
+}
+
+/*
+ * Returns the pooled copy of a name, adding it if needed.
+ * Input:
+ *  - name: the name, not necessarily NUL terminated
+ *  - len: length of the name
+ *  - hash: hash of the name
+ * Returns: the NUL terminated pooled name, or NULL if out of memory
+ */
+char *namepool_intern(char *name, int len, unsigned int hash) {
+    pthread_mutex_lock(&pool_lock);
+
+    PooledName **bucket = &buckets[hash & (nbuckets - 1)];
+    for (PooledName *entry = *bucket; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->len == len && memcmp(entry->chars, name, len) == 0) {
+            entry->refs++;
+            pthread_mutex_unlock(&pool_lock);
+            return entry->chars;
+        }
+    }
+
+    PooledName *entry = slab_alloc(namepool_entry_size(len));
+    if (entry == NULL) {
+        pthread_mutex_unlock(&pool_lock);
+        return NULL;
+    }
+    entry->hash = hash;
+    entry->refs = 1;
+    entry->len = len;
+    memcpy(entry->chars, name, len);
+    entry->chars[len] = '\0';
+    entry->next = *bucket;
+    *bucket = entry;
+    nbytes += namepool_entry_size(len);
+
+    if (++nnames > nbuckets * 2) {
+        namepool_grow();
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return entry->chars;
+}
+
+/*
+ * Drops a reference to a pooled name, retiring it with the last one.
+ * Input:
+ *  - name: a name returned by namepool_intern
+ */
+void namepool_release(char *name) {
+    PooledName *entry = (PooledName *) (name - offsetof(PooledName, chars));
+
+    pthread_mutex_lock(&pool_lock);
+    if (--entry->refs == 0) {
+        PooledName **link = &buckets[entry->hash & (nbuckets - 1)];
+        while (*link != entry) {
+            link = &(*link)->next;
+        }
+        *link = entry->next;
+        nnames--;
+        nbytes -= namepool_entry_size(entry->len);
+        /* optimistic lookups may still be comparing against it */
+        epoch_retire(entry, namepool_entry_size(entry->len), slab_free);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Returns the number of bytes used by pooled names.
+ */
+size_t namepool_bytes() {
+    pthread_mutex_lock(&pool_lock);
+    size_t bytes = nbytes;
+    pthread_mutex_unlock(&pool_lock);
+    return bytes;
+}
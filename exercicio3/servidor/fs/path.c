@@ -0,0 +1,107 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "path.h"
+#include "state.h"
+
+
+/*
+ * Splits a path into its components in a single pass, without copying
+ * it. Empty components (repeated, leading or trailing slashes) are
+ * skipped.
+ * Input:
+ *  - name: the path, must outlive the parsed path
+ *  - path: reference to store the parsed path
+ * Returns: SUCCESS or FAIL (too many components)
+ */
+int path_parse(char *name, Path *path) {
+    unsigned int prefix_hash = PATH_HASH_INIT;
+    int prefix_len = 0;
+    PathComponent *component = NULL;
+
+    path->name = name;
+    path->depth = 0;
+    for (char *c = name; *c != '\0'; c++) {
+        if (*c == '/') {
+            component = NULL;
+            continue;
+        }
+        if (component == NULL) {
+            if (path->depth == MAX_PATH_DEPTH) {
+                return FAIL;
+            }
+            if (path->depth > 0) {
+                prefix_hash = PATH_HASH_STEP(prefix_hash, '/');
+                prefix_len++;
+            }
+            component = &path->components[path->depth++];
+            component->name = c;
+            component->len = 0;
+            component->hash = PATH_HASH_INIT;
+        }
+        component->len++;
+        component->hash = PATH_HASH_STEP(component->hash, *c);
+        prefix_hash = PATH_HASH_STEP(prefix_hash, *c);
+        component->prefix_len = ++prefix_len;
+        component->prefix_hash = prefix_hash;
+    }
+    return SUCCESS;
+}
+
+/*
+ * Checks if the first components of a path spell a canonical path.
+ * Input:
+ *  - path: parsed path
+ *  - depth: number of components to compare, at least 1
+ *  - canonical, len: the canonical path
+ * Returns: 1 if they match, 0 otherwise
+ */
+int path_prefix_matches(Path *path, int depth, char *canonical, int len) {
+    if (path->components[depth - 1].prefix_len != len) {
+        return 0;
+    }
+    for (int i = 0; i < depth; i++) {
+        PathComponent *component = &path->components[i];
+        if (memcmp(canonical, component->name, component->len) != 0) {
+            return 0;
+        }
+        /* the lengths match, but a/b and a.b only differ at the separator */
+        if (i + 1 < depth && canonical[component->len] != '/') {
+            return 0;
+        }
+        canonical += component->len + 1;
+    }
+    return 1;
+}
+
+/*
+ * Writes the canonical form of the first components of a path.
+ * Input:
+ *  - path: parsed path
+ *  - depth: number of components, at least 1
+ *  - canonical: buffer of MAX_FILE_NAME chars
+ */
+void path_copy_prefix(Path *path, int depth, char *canonical) {
+    for (int i = 0; i < depth; i++) {
+        PathComponent *component = &path->components[i];
+        memcpy(canonical, component->name, component->len);
+        canonical += component->len;
+        *canonical++ = i + 1 < depth ? '/' : '\0';
+    }
+}
+
+/*
+ * Returns the number of chars of the parsed string before its last
+ * component, without the slashes that separate them, so error messages
+ * can print the parent path as given.
+ */
+int path_parent_len(Path *path) {
+    if (path->depth == 0) {
+        return 0;
+    }
+    int len = path->components[path->depth - 1].name - path->name;
+    while (len > 0 && path->name[len - 1] == '/') {
+        len--;
+    }
+    return len;
+}
@@ -0,0 +1,31 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+/*
+ * Sequence counters for optimistic readers. A writer, already excluded
+ * from other writers by a lock, makes the counter odd while it changes the
+ * protected data and even again when it is done. A reader takes no lock:
+ * it reads the counter, reads the data, and only trusts what it read if
+ * the counter did not change (seq_read_retry returns 0).
+ */
+
+static inline unsigned int seq_read_begin(unsigned int *seq) {
+	return __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+}
+
+/* also fails for a start taken while a writer was active */
+static inline int seq_read_retry(unsigned int *seq, unsigned int start) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (start & 1) || __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+static inline void seq_write_begin(unsigned int *seq) {
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seq_write_end(unsigned int *seq) {
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* SEQLOCK_H */
@@ -0,0 +1,267 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "slab.h"
+#include "state.h"
+
+
+/* free objects are linked through their first word */
+typedef struct slabObject {
+    struct slabObject *next;
+} SlabObject;
+
+/* header at the start of every slab, objects follow it */
+typedef struct slabChunk {
+    struct slabChunk *next;
+} SlabChunk;
+
+typedef struct slabClass {
+    pthread_mutex_t lock;
+    SlabObject *freeList;   /* free objects not cached in a magazine */
+    SlabChunk *chunks;      /* slabs carved for this class */
+    size_t slabs;           /* number of slabs */
+    size_t carved;          /* objects carved from slabs */
+    size_t allocs;          /* allocations merged from magazines */
+    size_t frees;           /* frees merged from magazines */
+} SlabClass;
+
+typedef struct slabMagazine {
+    int count;
+    void *objects[SLAB_MAGAZINE_SIZE];
+    size_t allocs;          /* not yet merged into the class */
+    size_t frees;
+} SlabMagazine;
+
+static SlabClass classes[SLAB_CLASSES];
+static size_t large_allocs = 0;
+
+static __thread SlabMagazine magazines[SLAB_CLASSES];
+static __thread int magazines_registered = 0;
+static pthread_key_t magazine_key;
+static pthread_once_t magazine_key_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Returns the class of the smallest objects that fit size bytes.
+ */
+static int slab_class(size_t size) {
+    if (size <= SLAB_MIN_SIZE) {
+        return 0;
+    }
+    return (int) (sizeof(unsigned long) * 8 - __builtin_clzl(size - 1)) - SLAB_MIN_SHIFT;
+}
+
+static size_t slab_object_size(int c) {
+    return (size_t) SLAB_MIN_SIZE << c;
+}
+
+/*
+ * Moves the counters of a magazine into its class.
+ * Must be called with the class lock held.
+ */
+static void slab_merge_counters(SlabClass *class, SlabMagazine *mag) {
+    class->allocs += mag->allocs;
+    class->frees += mag->frees;
+    mag->allocs = 0;
+    mag->frees = 0;
+}
+
+/*
+ * Returns the n objects at the top of a magazine to its class.
+ * Must be called with the class lock held.
+ */
+static void slab_flush(SlabClass *class, SlabMagazine *mag, int n) {
+    while (n-- > 0) {
+        SlabObject *object = mag->objects[--mag->count];
+        object->next = class->freeList;
+        class->freeList = object;
+    }
+    slab_merge_counters(class, mag);
+}
+
+/*
+ * Returns every cached object of an exiting thread to the classes.
+ */
+static void slab_thread_exit(void *arg) {
+    SlabMagazine *mags = arg;
+
+    for (int c = 0; c < SLAB_CLASSES; c++) {
+        pthread_mutex_lock(&classes[c].lock);
+        slab_flush(&classes[c], &mags[c], mags[c].count);
+        pthread_mutex_unlock(&classes[c].lock);
+    }
+}
+
+static void slab_create_key() {
+    if (pthread_key_create(&magazine_key, slab_thread_exit) != 0) {
+        perror("Error: Cannot create slab magazine key.");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Returns the calling thread's magazine for a class, registering the
+ * thread so its magazines are flushed when it exits.
+ */
+static SlabMagazine *slab_magazine(int c) {
+    if (!magazines_registered) {
+        pthread_once(&magazine_key_once, slab_create_key);
+        pthread_setspecific(magazine_key, magazines);
+        magazines_registered = 1;
+    }
+    return &magazines[c];
+}
+
+/*
+ * Fills half of an empty magazine from the class free list, carving a new
+ * slab if the free list is empty.
+ * Returns: SUCCESS or FAIL
+ */
+static int slab_refill(int c, SlabMagazine *mag) {
+    SlabClass *class = &classes[c];
+    size_t size = slab_object_size(c);
+
+    pthread_mutex_lock(&class->lock);
+    if (class->freeList == NULL) {
+        SlabChunk *chunk;
+        if (posix_memalign((void **) &chunk, SLAB_MIN_SIZE, SLAB_SIZE) != 0) {
+            pthread_mutex_unlock(&class->lock);
+            return FAIL;
+        }
+        chunk->next = class->chunks;
+        class->chunks = chunk;
+        class->slabs++;
+
+        /* objects start after the header, keeping SLAB_MIN_SIZE alignment */
+        char *base = (char *) chunk + SLAB_MIN_SIZE;
+        size_t n = (SLAB_SIZE - SLAB_MIN_SIZE) / size;
+        for (size_t i = n; i-- > 0; ) {
+            SlabObject *object = (SlabObject *) (base + i * size);
+            object->next = class->freeList;
+            class->freeList = object;
+        }
+        class->carved += n;
+    }
+    while (mag->count < SLAB_MAGAZINE_SIZE / 2 && class->freeList != NULL) {
+        mag->objects[mag->count++] = class->freeList;
+        class->freeList = class->freeList->next;
+    }
+    slab_merge_counters(class, mag);
+    pthread_mutex_unlock(&class->lock);
+    return SUCCESS;
+}
+
+
+/*
+ * Initializes the size classes.
+ */
+void slab_init() {
+    for (int c = 0; c < SLAB_CLASSES; c++) {
+        pthread_mutex_init(&classes[c].lock, NULL);
+        classes[c].freeList = NULL;
+        classes[c].chunks = NULL;
+        classes[c].slabs = 0;
+        classes[c].carved = 0;
+        classes[c].allocs = 0;
+        classes[c].frees = 0;
+    }
+    large_allocs = 0;
+}
+
+/*
+ * Releases every slab. No object may be used afterwards.
+ */
+void slab_destroy() {
+    for (int c = 0; c < SLAB_CLASSES; c++) {
+        SlabChunk *chunk = classes[c].chunks;
+        while (chunk != NULL) {
+            SlabChunk *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+        classes[c].chunks = NULL;
+        classes[c].freeList = NULL;
+        /* the calling thread's magazine points into the released slabs */
+        magazines[c].count = 0;
+        pthread_mutex_destroy(&classes[c].lock);
+    }
+}
+
+/*
+ * Allocates an object.
+ * Input:
+ *  - size: number of bytes needed
+ * Returns: the object, or NULL if out of memory
+ */
+void *slab_alloc(size_t size) {
+    if (size > SLAB_MAX_SIZE) {
+        __atomic_fetch_add(&large_allocs, 1, __ATOMIC_RELAXED);
+        return malloc(size);
+    }
+
+    int c = slab_class(size);
+    SlabMagazine *mag = slab_magazine(c);
+
+    if (mag->count == 0 && slab_refill(c, mag) == FAIL) {
+        return NULL;
+    }
+    mag->allocs++;
+    return mag->objects[--mag->count];
+}
+
+/*
+ * Releases an object.
+ * Input:
+ *  - ptr: object returned by slab_alloc, or NULL
+ *  - size: the size given to slab_alloc
+ */
+void slab_free(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (size > SLAB_MAX_SIZE) {
+        free(ptr);
+        return;
+    }
+
+    int c = slab_class(size);
+    SlabMagazine *mag = slab_magazine(c);
+
+    if (mag->count == SLAB_MAGAZINE_SIZE) {
+        pthread_mutex_lock(&classes[c].lock);
+        slab_flush(&classes[c], mag, SLAB_MAGAZINE_SIZE / 2);
+        pthread_mutex_unlock(&classes[c].lock);
+    }
+    mag->frees++;
+    mag->objects[mag->count++] = ptr;
+}
+
+/*
+ * Prints the occupancy of each size class and how many malloc calls the
+ * slabs avoided. Counters of threads still running are only included up
+ * to their last refill or flush.
+ * Input:
+ *  - fp: pointer to output file
+ */
+void slab_print_stats(FILE *fp) {
+    size_t allocs = 0, slabs = 0;
+
+    for (int c = 0; c < SLAB_CLASSES; c++) {
+        SlabClass *class = &classes[c];
+
+        pthread_mutex_lock(&class->lock);
+        slab_merge_counters(class, &magazines[c]);
+        if (class->allocs > 0) {
+            fprintf(fp, "slab %6zu B: %zu slabs, %zu objects, %zu in use, %zu allocs\n",
+                    slab_object_size(c), class->slabs, class->carved,
+                    class->allocs - class->frees, class->allocs);
+        }
+        allocs += class->allocs;
+        slabs += class->slabs;
+        pthread_mutex_unlock(&class->lock);
+    }
+    fprintf(fp, "slab: %zu allocs, %zu malloc calls avoided, %zu large allocs\n",
+            allocs, allocs > slabs ? allocs - slabs : 0,
+            __atomic_load_n(&large_allocs, __ATOMIC_RELAXED));
+}
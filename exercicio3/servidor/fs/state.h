@@ -4,14 +4,28 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "../tecnicofs-api-constants.h"
+#include "directory.h"
+#include "path.h"
+#include "filedata.h"
+#include "seqlock.h"
+#include "bravo.h"
 
 /* FS root inode number */
 #define FS_ROOT 0
 
 #define FREE_INODE -1
-#define INODE_TABLE_SIZE 50
-#define MAX_DIR_ENTRIES 20
+
+/*
+ * The i-node table is split in chunks of INODE_CHUNK_SIZE i-nodes that are
+ * only allocated when needed. Chunks never move, so an inumber keeps
+ * pointing to the same i-node while the table grows.
+ */
+#define INODE_CHUNK_BITS 12
+#define INODE_CHUNK_SIZE (1 << INODE_CHUNK_BITS)
+#define INODE_MAX_CHUNKS 4096
+#define INODE_TABLE_SIZE (INODE_CHUNK_SIZE * INODE_MAX_CHUNKS)
 
 #define SUCCESS 0
 #define FAIL -1
@@ -23,41 +37,59 @@
 
 
 /*
- * Contains the name of the entry and respective i-number
- */
-typedef struct dirEntry {
-	char name[MAX_FILE_NAME];
-	int inumber;
-} DirEntry;
-
-/*
- * Data is either text (file) or entries (DirEntry)
+ * Data is either contents (file) or entries (Directory)
  */
 union Data {
-	char *fileContents; /* for files */
-	DirEntry *dirEntries; /* for directories */
+	FileData file; /* for files */
+	Directory *dir; /* for directories */
 };
 
 /*
- * I-node definition
+ * I-node definition. Each i-node starts on a cache line of its own. The
+ * fields read by every path walk come first and fill that line. The lock,
+ * written by every lock and unlock, starts on the next line, so locking
+ * an i-node does not invalidate the traversal fields of it or of its
+ * neighbours. Cold fields go after the lock.
  */
 typedef struct inode_t {
+	/* read-mostly, the first cache line */
+	unsigned int version; /* sequence counter for lock-free readers, see seqlock.h */
 	type nodeType;
+	unsigned int generation; /* bumped every time the i-node is reused */
+	int parent; /* directory holding its entry, FAIL for the root, see dir_add_entry */
 	union Data data;
+
+	BravoLock inodeLock __attribute__((aligned(64)));
+
+	/* cold */
+	int nextFree; /* next free i-node, only meaningful while T_NONE */
+	//pthread_mutex_t mutex;
+	//pthread_cond_t cond;
     /* more i-node attributes will be added in future exercises */
-} inode_t;
+} __attribute__((aligned(64))) inode_t;
+
+extern inode_t *inode_chunks[INODE_MAX_CHUNKS];
 
-inode_t inode_table[INODE_TABLE_SIZE];
+/*
+ * Returns the i-node with the given inumber. The inumber must belong to an
+ * already allocated chunk (see inode_exists).
+ */
+static inline inode_t *inode_ref(int inumber) {
+	return &inode_chunks[inumber >> INODE_CHUNK_BITS][inumber & (INODE_CHUNK_SIZE - 1)];
+}
 
 void insert_delay(int cycles);
 void inode_table_init();
 void inode_table_destroy();
+int inode_exists(int inumber);
 int inode_create(type nType);
 int inode_delete(int inumber);
 int inode_get(int inumber, type *nType, union Data *data);
-int inode_set_file(int inumber, char *fileContents, int len);
-int dir_reset_entry(int inumber, int sub_inumber);
-int dir_add_entry(int inumber, int sub_inumber, char *sub_name);
+int inode_write(int inumber, char *buf, size_t len, size_t offset);
+int inode_read(int inumber, char *buf, size_t len, size_t offset);
+int inode_read_iov(int inumber, size_t offset, size_t len, struct iovec *iov, int iovcnt);
+int dir_reset_entry(int inumber, int sub_inumber, PathComponent *sub_name);
+int dir_add_entry(int inumber, int sub_inumber, PathComponent *sub_name);
 void inode_print_tree(FILE *fp, int inumber, char *name);
 
 
@@ -12,20 +12,30 @@
 #include <sys/uio.h>
 #include "fs/timer.h"
 #include "fs/operations.h"
+#include "fs/lockprof.h"
+#include "command.h"
 #include "assert.h"
 #include <sys/stat.h>
+#include <signal.h>
 
 #define MAX_INPUT_SIZE 100
 #define MAX_OUTPUT_SIZE 100
-#define INDIM 30
+/* a move carries two paths, a write a path, an offset and its data */
+#define INDIM (2 * MAX_INPUT_SIZE + 32)
+/* bytes of a file a read sends at most, and the pages they can span */
+#define READ_MAX_SIZE (16 * FILE_PAGE_SIZE)
+#define READ_MAX_IOV (READ_MAX_SIZE / FILE_PAGE_SIZE + 1)
 #define OUTDIM 512
 
 int numberThreads = 0;
 char *socket_path = NULL;
 char *output_file = NULL;
-socklen_t addrlen;
 int sockfd;
-pthread_mutex_t global;
+/* operations share it, printing the tree takes it exclusively; read
+ * biased, since it is written only by print */
+BravoLock treeLock;
+/* set by SIGUSR1, the next thread to wake up prints the lock profile */
+volatile sig_atomic_t reportRequested = 0;
 
 
 static void displayUsage (const char* appName){
@@ -56,15 +66,17 @@ void errorParse(){
 }
 
 
-void lockMutex(pthread_mutex_t mutex){
-    if (pthread_mutex_lock(&mutex) != 0){
-        perror("error: can't lock mutex.\n");
+void lockTree(int operation){
+    int err = operation == WRITE ? lockprof_wrlock(&treeLock, LOCKPROF_TREE) :
+                                   lockprof_rdlock(&treeLock, LOCKPROF_TREE);
+    if (err != 0){
+        perror("error: can't lock rwlock.\n");
     }
 }
 
-void unlockMutex(pthread_mutex_t mutex){
-    if (pthread_mutex_unlock(&mutex) != 0){
-        perror("error: can't unlock mutex.\n");
+void unlockTree(){
+    if (lockprof_rwunlock(&treeLock, LOCKPROF_TREE) != 0){
+        perror("error: can't unlock rwlock.\n");
     }
 }
 
@@ -80,76 +92,134 @@ FILE * openOutputFile(char *filename){
 }
 
 
-int applyCommands(void *command){
+/*
+ * Sends the return value of a command to its client.
+ */
+void sendReply(int value, struct sockaddr_un *client_addr, socklen_t addrlen){
+    sendto(sockfd, &value, sizeof(value), 0, (struct sockaddr *) client_addr, addrlen);
+}
+
+
+/*
+ * Replies to a read with the number of bytes read (or FAIL) followed by
+ * the bytes, sent straight from the pages of the file while it is locked.
+ */
+void sendFile(Command *command, struct sockaddr_un *client_addr, socklen_t addrlen){
+    struct iovec iov[READ_MAX_IOV + 1];
+    struct msghdr msg;
+    LockTable table;
+    size_t len = command->len < READ_MAX_SIZE ? command->len : READ_MAX_SIZE;
+    int res;
 
-    if (command == NULL){
-        return EXIT_FAILURE;
+    table.counter = 0;
+    lockTree(READ);
+    int n = read_file_iov(command_path(command), command->offset, len,
+                          iov + 1, READ_MAX_IOV, &table);
+    res = n != FAIL ? 0 : FAIL;
+    for (int i = 1; i <= n; i++) {
+        res += iov[i].iov_len;
     }
+    iov[0].iov_base = &res;
+    iov[0].iov_len = sizeof(res);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = client_addr;
+    msg.msg_namelen = addrlen;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n != FAIL ? n + 1 : 1;
+    if (sendmsg(sockfd, &msg, 0) < 0) {
+        perror("server: sendmsg error");
+    }
+    if (n != FAIL) {
+        unlockFromArray(&table);
+    }
+    unlockTree();
+}
+
+
+/*
+ * Applies a command received and replies to its client.
+ */
+void applyCommands(char *message, struct sockaddr_un *client_addr, socklen_t addrlen){
     FILE *output_file;
     int res;
-    char token, type;
-    char name[MAX_INPUT_SIZE];
-    int numTokens = sscanf((const char*) command, "%c %s %c", &token, name, &type);
+    Command command;
 
-    if (numTokens < 2) {
-        fprintf(stderr, "Error: invalid command in Queue\n");
-        return EXIT_FAILURE;
+    if (command_parse(message, &command) == FAIL) {
+        fprintf(stderr, "Error: invalid command\n");
+        sendReply(EXIT_FAILURE, client_addr, addrlen);
+        return;
     }
+    char *name = command_path(&command);
 
-    int searchResult;
-    switch (token) {
+    switch (command.op) {
         case 'c':
-            switch (type) {
-                case 'f':
-                    printf("Create file: %s\n", name);
-                    lockMutex(global);
-                    res = create(name, T_FILE);
-                    unlockMutex(global);
-                    return res;
-                case 'd':
-                    printf("Create directory: %s\n", name);
-                    lockMutex(global);
-                    res = create(name, T_DIRECTORY);
-                    unlockMutex(global);
-                    return res;
-                default:
-                    fprintf(stderr, "Error: invalid node type\n");
-                    return EXIT_FAILURE;
-            }
+            if (command.nodeType == T_FILE)
+                printf("Create file: %s\n", name);
+            else
+                printf("Create directory: %s\n", name);
+            lockTree(READ);
+            res = create(name, command.nodeType);
+            unlockTree();
             break;
 
         case 'l':
-            lockMutex(global);
-            searchResult = lookup(name);
-            unlockMutex(global);
-            if (searchResult >= 0)
+            lockTree(READ);
+            res = lookup(name, READ, NULL);
+            unlockTree();
+            if (res >= 0)
                 printf("Search: %s found\n", name);
             else
                 printf("Search: %s not found\n", name);
-            return searchResult;
+            break;
 
         case 'd':
             printf("Delete: %s\n", name);
-            lockMutex(global);
+            lockTree(READ);
             res = delete(name);
-            unlockMutex(global);
-            return res;
+            unlockTree();
+            break;
         
+        case 'm':
+            printf("Move: %s to %s\n", name, command_target(&command));
+            /* locks the two parents only, moves in other directories
+             * and other operations go on */
+            lockTree(READ);
+            res = move(name, command_target(&command));
+            unlockTree();
+            break;
+
+        case 'w':
+            printf("Write: %s\n", name);
+            lockTree(READ);
+            res = write_file(name, command_data(&command), command.len, command.offset);
+            unlockTree();
+            break;
+
+        case 'r':
+            printf("Read: %s\n", name);
+            sendFile(&command, client_addr, addrlen);
+            return;
+
         case 'p':
-            lockMutex(global);
+            /* waits for the operations in progress, so the tree printed
+             * is a state the file system was in */
+            lockTree(WRITE);
 
             output_file = openOutputFile(name);
             print_tecnicofs_tree(output_file);
+            fclose(output_file);
 
-            unlockMutex(global);
-            return EXIT_SUCCESS;
+            unlockTree();
+            res = EXIT_SUCCESS;
+            break;
 
         default: { /* error */
             fprintf(stderr, "Error: command to apply\n");
-            return EXIT_FAILURE;
+            res = EXIT_FAILURE;
         }
     }
-    return EXIT_FAILURE;
+    sendReply(res, client_addr, addrlen);
 }
 
 
@@ -165,15 +235,42 @@ int setSockAddrUn(char *path, struct sockaddr_un *addr) { //sets socketaddr_un m
 }
 
 
+static void requestReport(int signo){
+    reportRequested = 1;
+}
+
+
+/*
+ * Prints the lock profile on SIGUSR1, if TECNICOFS_LOCKPROF is set.
+ * The signal interrupts a thread waiting for a command, which prints it.
+ */
+void initReportSignal(){
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestReport;
+    sigemptyset(&action.sa_mask);
+    /* no SA_RESTART, so recvfrom returns */
+    if (sigaction(SIGUSR1, &action, NULL) != 0){
+        perror("error: can't set SIGUSR1 handler");
+    }
+}
+
+
 void* recebe_comando(){
 
     while (1) {
         struct sockaddr_un client_addr;
+        /* each worker's own, recvfrom writes the sender's length in it */
+        socklen_t addrlen = sizeof(struct sockaddr_un);
         char comando[INDIM];
         int c;
-        int return_value;
 
-        addrlen = sizeof(struct sockaddr_un);
+        if (reportRequested) {
+            reportRequested = 0;
+            lockprof_report(stderr);
+        }
+
         c = recvfrom(sockfd, comando, sizeof(comando) - 1, 0,
             (struct sockaddr *) &client_addr, &addrlen); //Recebe mensagem do cliente
         if (c <= 0) continue;
@@ -182,10 +279,8 @@ void* recebe_comando(){
         comando[c] = '\0';
         printf("Mensagem recebida: %s\n", comando);
 
-        return_value = applyCommands(comando);  //executa comando
-
-        /* Envia resposta ao cliente */
-        sendto(sockfd, (const int *) &return_value, sizeof(return_value), 0, (struct sockaddr *) &client_addr, addrlen);
+        /* executa comando e envia resposta ao cliente */
+        applyCommands(comando, &client_addr, addrlen);
     }
     //Fechar e apagar o nome do socket, apesar deste programa 
     //nunca chegar a este ponto
@@ -196,6 +291,7 @@ void* recebe_comando(){
 
 void init_socket(){
     struct sockaddr_un server_addr;
+    socklen_t addrlen;
 
     if ((sockfd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
         perror("server: can't open socket");
@@ -225,6 +321,12 @@ void poolThreads(){
         }
     }
 
+    /* the workers keep SIGUSR1 unblocked, so one of them handles it */
+    sigset_t report;
+    sigemptyset(&report);
+    sigaddset(&report, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &report, NULL);
+
     for (int i = 0; i < numberThreads; i++) {
         if (pthread_join(threads[i], NULL)) {
             perror("Error: can't join thread.");
@@ -239,21 +341,22 @@ int main(int argc, char* argv[]) {
     init_fs();
     parseArgs(argc, argv);
 
-    /* init mutex */
-    if (pthread_mutex_init(&global, NULL) != 0){
-        perror("error: can't init mutex");
+    /* init tree lock */
+    if (bravo_init(&treeLock) != 0){
+        perror("error: can't init rwlock");
     }
     
     /* init socket data structs */
     init_socket();
+    initReportSignal();
     
     /* creates thread pool */
     poolThreads(stdout);
 
     /* release allocated memory */
     destroy_fs();
-    if (pthread_mutex_destroy(&global) != 0){
-        perror("error: can't destroy mutex");
+    if (bravo_destroy(&treeLock) != 0){
+        perror("error: can't destroy rwlock");
     };
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file